@@ -0,0 +1,269 @@
+// Drives synthetic capturers through the whole recording path (capturer,
+// out-stream, writers, file manager) and reports throughput, stage
+// latencies, cpu and bytes written, so hot path changes can be measured
+// without cameras.
+//
+// usage: househub_bench [--cameras=4] [--seconds=30] [--width=1280]
+//                       [--height=720] [--input_fps=0] [--output_fps=10]
+//                       [--output_width=1024] [--output_height=768]
+//                       [--fourcc=mjpg] [--extension=.avi] [--workers=0]
+//                       [--record_dir=/tmp/househub-bench/] [--file=]
+//                       [--memory_budget_mb=0] [--queue_budget_kb=32768]
+//                       [--shed_policy=drop_frames]
+//
+// Each run records into a fresh run-<time> directory under record_dir.
+//
+//        househub_bench --mode=preprocess [--frames=300] [--width=1280]
+//                       [--height=720] [--output_width=1024]
+//                       [--output_height=768] [--filter_k=3] [--flip_x=0]
+//                       [--flip_y=0] [--preprocess_threads=1]
+//
+// compares the fused preprocessor with the resize, median blur and flip
+// chain it replaced, on the same frame.
+
+#include "capturer_factory.h"
+#include "file_manager.h"
+#include "file_system.h"
+#include "globals.h"
+#include "preprocessor.h"
+#include <cstdio>
+#include <map>
+#include <thread>
+
+namespace {
+using Options = std::map<std::string, std::string>;
+
+std::string option(const Options &options, const std::string &key,
+                   const std::string &defaultValue) {
+  const auto it = options.find(key);
+  return it == options.end() ? defaultValue : it->second;
+}
+
+int intOption(const Options &options, const std::string &key,
+              int defaultValue) {
+  return std::stoi(option(options, key, std::to_string(defaultValue)));
+}
+
+uint64_t dirBytes(const std::string &dir) {
+  uint64_t bytes = 0;
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (fs::is_regular_file(it->path(), ec)) {
+      bytes += fs::file_size(it->path(), ec);
+    }
+  }
+  return bytes;
+}
+
+uint64_t processCpuNs() {
+  timespec ts{};
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+double ms(uint64_t ns) { return ns / 1e6; }
+
+int benchPreprocess(const Options &options) {
+  const int frames = intOption(options, "frames", 300);
+  PreprocessorParams pp;
+  pp.outputSize = cv::Size(intOption(options, "output_width", 1024),
+                           intOption(options, "output_height", 768));
+  pp.filterK = intOption(options, "filter_k", 3);
+  pp.flipX = intOption(options, "flip_x", 0) != 0;
+  pp.flipY = intOption(options, "flip_y", 0) != 0;
+  pp.threads = intOption(options, "preprocess_threads", 1);
+  Preprocessor preprocessor;
+  if (frames <= 0 || !preprocessor.init(pp)) {
+    fprintf(stderr, "bad frames or preprocessor options\n");
+    return 1;
+  }
+
+  cv::Mat src(cv::Size(intOption(options, "width", 1280),
+                       intOption(options, "height", 720)),
+              CV_8UC3);
+  cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+
+  // the chain the capturer ran before the preprocessor
+  const auto chain = [&](cv::Mat &dst) {
+    cv::resize(src, dst, pp.outputSize);
+    if (pp.filterK > 1) {
+      cv::medianBlur(dst, dst, pp.filterK % 2 ? pp.filterK : pp.filterK + 1);
+    }
+    if (pp.flipX || pp.flipY) {
+      cv::flip(dst, dst, pp.flipX && pp.flipY ? -1 : (pp.flipY ? 1 : 0));
+    }
+  };
+  const auto fused = [&](cv::Mat &dst) { preprocessor.process(src, dst); };
+
+  cv::Mat chainOut, fusedOut;
+  const auto run = [&](const std::function<void(cv::Mat &)> &f, cv::Mat &dst,
+                       const char *name) {
+    f(dst); // buffers and maps
+    const uint64_t cpuStartNs = processCpuNs();
+    const uint64_t startNs = steadyTimeNs();
+    for (int i = 0; i < frames; ++i) {
+      f(dst);
+    }
+    const uint64_t wallNs = steadyTimeNs() - startNs;
+    const uint64_t cpuNs = processCpuNs() - cpuStartNs;
+    printf("%-20s %10.3f %10.3f\n", name, ms(wallNs) / frames,
+           ms(cpuNs) / frames);
+    return wallNs;
+  };
+
+  printf("%-20s %10s %10s\n", "", "ms/frame", "cpu ms");
+  const uint64_t chainNs = run(chain, chainOut, "resize+median+flip");
+  const uint64_t fusedNs = run(fused, fusedOut, "preprocessor");
+  printf("\nspeedup %.2fx, outputs differ by up to %.0f gray levels\n",
+         static_cast<double>(chainNs) / std::max<uint64_t>(1, fusedNs),
+         cv::norm(chainOut, fusedOut, cv::NORM_INF));
+
+  return 0;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  google::SetStderrLogging(google::GLOG_WARNING);
+
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      fprintf(stderr, "bad argument: %s\n", arg.c_str());
+      return 1;
+    }
+    options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+  }
+
+  if (option(options, "mode", "record") == "preprocess") {
+    return benchPreprocess(options);
+  }
+
+  const int cameras = intOption(options, "cameras", 4);
+  const int seconds = intOption(options, "seconds", 30);
+  const std::string fourcc = option(options, "fourcc", "mjpg");
+  if (cameras <= 0 || seconds <= 0 || fourcc.length() != 4) {
+    fprintf(stderr, "bad cameras, seconds or fourcc\n");
+    return 1;
+  }
+
+  FileManagerParams fmp;
+  fmp.recordDir = option(options, "record_dir", "/tmp/househub-bench/");
+  if (!fmp.recordDir.empty() && fmp.recordDir.back() != '/') {
+    fmp.recordDir += '/';
+  }
+  // earlier runs neither add to the bytes written nor get evicted
+  fmp.recordDir += "run-" + std::to_string(std::time(nullptr)) + "/";
+  auto &fm = FileManager::instance();
+  if (!fm.init(fmp)) {
+    fprintf(stderr, "record dir r/w error: %s\n", fmp.recordDir.c_str());
+    return 1;
+  }
+
+  WorkerPool workerPool;
+  if (!workerPool.init(intOption(options, "workers", 0))) {
+    return 1;
+  }
+  MjpegHttpLoop httpLoop;
+  MemoryBudget memoryBudget;
+  memoryBudget.init(
+      static_cast<uint64_t>(intOption(options, "memory_budget_mb", 0)) *
+      1048576);
+
+  std::vector<std::unique_ptr<ICapturer>> capturers;
+  for (int i = 0; i < cameras; ++i) {
+    CapturerParams cp;
+    cp.name = "BENCH" + std::to_string(i + 1);
+    cp.type = "synthetic";
+    cp.syntheticParams.frameSize = cv::Size(intOption(options, "width", 1280),
+                                            intOption(options, "height", 720));
+    cp.syntheticParams.fps = intOption(options, "input_fps", 0);
+    cp.syntheticParams.file = option(options, "file", "");
+
+    VideoOutStreamParams &vp = cp.videoOutStreamParams;
+    vp.name = cp.name;
+    vp.fps = intOption(options, "output_fps", 10);
+    vp.outputSize = cv::Size(intOption(options, "output_width", 1024),
+                             intOption(options, "output_height", 768));
+    vp.fileExtension = option(options, "extension", ".avi");
+    std::copy(fourcc.c_str(), fourcc.c_str() + 4, vp.fourcc);
+    vp.queueBudgetBytes =
+        static_cast<uint64_t>(intOption(options, "queue_budget_kb", 32768)) *
+        1024;
+    vp.memoryBudget = &memoryBudget;
+    vp.shedPolicy = VideoOutStream::parseShedPolicy(
+        option(options, "shed_policy", "drop_frames"));
+
+    auto cap = CapturerFactory::createCapturer(cp, workerPool, httpLoop);
+    if (!cap || !cap->init(cp)) {
+      fprintf(stderr, "capturer could not be started: %s\n", cp.name.c_str());
+      return 1;
+    }
+    capturers.push_back(std::move(cap));
+  }
+
+  const uint64_t cpuStartNs = processCpuNs();
+  const uint64_t startNs = steadyTimeNs();
+  for (auto &cap : capturers) {
+    cap->startCapture();
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+  std::vector<CapturerStats> stats;
+  for (auto &cap : capturers) {
+    cap->stopCapture();
+    stats.push_back(cap->stats());
+  }
+  const double wallSec = (steadyTimeNs() - startNs) / 1e9;
+  const uint64_t cpuNs = processCpuNs() - cpuStartNs;
+
+  // the chunks are finalized on the way out
+  capturers.clear();
+  httpLoop.stop();
+  workerPool.stop();
+  const uint64_t bytes = dirBytes(fmp.recordDir) + fm.stats().evictedBytes;
+
+  printf("%-8s %8s %8s %8s %17s %17s %17s %17s %6s\n", "camera", "grab/s",
+         "proc/s", "dropped", "grab p50/p99 ms", "proc p50/p99 ms",
+         "write p50/p99 ms", "encode p50/p99 ms", "busy%");
+
+  uint64_t processed = 0;
+  uint64_t shed = 0;
+  for (size_t i = 0; i < stats.size(); ++i) {
+    const CapturerStats &s = stats[i];
+    const uint64_t dropped = s.ring.droppedOldest + s.ring.droppedNewest;
+    // writes are queued within the process stage, encoding runs on the
+    // pool and finalizing on the io worker
+    const uint64_t busyNs = s.grab.busyNs + s.process.busyNs +
+                            s.out.encode.busyNs + s.out.finalize.busyNs;
+    printf("%-8s %8.1f %8.1f %8llu %8.2f/%8.2f %8.2f/%8.2f %8.2f/%8.2f "
+           "%8.2f/%8.2f %6.1f\n",
+           ("BENCH" + std::to_string(i + 1)).c_str(), s.grab.frames / wallSec,
+           s.process.frames / wallSec, static_cast<unsigned long long>(dropped),
+           ms(s.grab.percentileNs(0.5)), ms(s.grab.percentileNs(0.99)),
+           ms(s.process.percentileNs(0.5)), ms(s.process.percentileNs(0.99)),
+           ms(s.out.write.percentileNs(0.5)),
+           ms(s.out.write.percentileNs(0.99)),
+           ms(s.out.encode.percentileNs(0.5)),
+           ms(s.out.encode.percentileNs(0.99)),
+           100.0 * busyNs / (wallSec * 1e9));
+    processed += s.process.frames;
+    shed += s.out.shedFrames + s.out.thinnedFrames + s.out.downscaledFrames;
+  }
+
+  printf("\nprocessed %.1f frames/s in total, process cpu %.1f%% "
+         "(%.1f%% per camera)\n",
+         processed / wallSec, 100.0 * cpuNs / (wallSec * 1e9),
+         100.0 * cpuNs / (wallSec * 1e9) / cameras);
+  printf("written %.1f MB, %.2f MB/s\n", bytes / 1048576.0,
+         bytes / 1048576.0 / wallSec);
+  printf("queued writes peaked at %.1f MB, %llu frames shed\n",
+         memoryBudget.stats().peakBytes / 1048576.0,
+         static_cast<unsigned long long>(shed));
+
+  return 0;
+}
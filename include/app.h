@@ -1,8 +1,14 @@
 #pragma once
 
 #include "icapturer.h"
+#include "memory_budget.h"
+#include "metrics_server.h"
+#include "mjpeg_http_loop.h"
+#include "worker_pool.h"
 #include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 class App final {
@@ -26,10 +32,20 @@ private:
 
   ExitCode initFileManager();
 
+  ExitCode initWorkerPool();
+
   ExitCode initCapturers();
 
+  ExitCode initMetrics();
+
   static void signalHandler(int signum);
 
+  WorkerPool mWorkerPool;
+  MjpegHttpLoop mMjpegHttpLoop;
+  MemoryBudget mMemoryBudget; // of all the streams' queued writes
   std::vector<std::unique_ptr<ICapturer>> mCapturers;
+  MetricsServer mMetricsServer;
   static std::atomic_bool sExitFlag;
+  static std::mutex sExitMutex;
+  static std::condition_variable sExitCondition;
 };
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+// Jittered exponential backoff between reconnect attempts. The n-th delay is
+// drawn from [d/2, d] with d = min * 2^n capped at max, so a dead peer is
+// tried less and less often and peers that failed together spread out.
+class Backoff {
+public:
+  Backoff();
+
+  void init(uint32_t minMs, uint32_t maxMs);
+
+  uint64_t nextDelayMs();
+
+  void reset();
+
+  uint32_t attempts() const;
+
+private:
+  uint32_t mMinMs = 500;
+  uint32_t mMaxMs = 30000;
+  uint32_t mAttempts = 0;
+  std::minstd_rand mRandom;
+};
@@ -1,13 +1,24 @@
 #pragma once
 
+#include "backoff.h"
 #include "icapturer.h"
+#include "mjpeg_http_loop.h"
+#include "mjpeg_http_stream.h"
+#include "preprocessor.h"
+#include "worker_pool.h"
 #include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <thread>
 
-class Capturer : public ICapturer {
+enum class InStreamState { CONNECTING, OPEN, BACKOFF };
+
+// Grabs on its own thread, or with an http loop reads its mjpeg in-stream
+// on the loop's thread shared with other capturers.
+class Capturer : public ICapturer, private IMjpegSink {
 public:
-  Capturer();
+  explicit Capturer(WorkerPool &workerPool,
+                    MjpegHttpLoop *httpLoop = nullptr);
 
   ~Capturer();
 
@@ -21,16 +32,90 @@ public:
 
   bool isStreamHealthy() const override;
 
+  void triggerEvent() override;
+
+  CapturerStats stats() const override;
+
   CapturerParams &params() override;
 
 private:
+  void grabLoop();
+
+  void startConnect();
+
+  void connectInStream();
+
+  void finishConnect();
+
+  void scheduleReconnect();
+
+  bool grabFrame(const time_t t);
+
+  bool waitForWakeUp(std::chrono::milliseconds timeout);
+
+  std::vector<uchar> *acquireJpeg() override;
+
+  void commitJpeg(uint64_t busyNs) override;
+
+  void tick() override;
+
+  void streamChanged(bool healthy) override;
+
+  void wakeUp();
+
+  void scheduleProcessing();
+
+  void processTask();
+
+  void processFrame(RingFrame &rf);
+
+  // true if the frame is still
+  bool detectMotion(double score, const time_t t);
+
+  static int reducedDecodeFlag(const cv::Size &srcSize,
+                               const cv::Size &outputSize);
+
   CapturerParams mParams;
   std::atomic_bool mExitFlag = false;
   std::atomic_bool mCapturing = false;
   std::atomic_bool mStreamHealthy = false;
-  std::thread mCaptureThread;
+  std::thread mGrabThread;
+  std::mutex mGrabMutex;
+  std::condition_variable mGrabCondition;
+  bool mWakeUpFlag = false;
+  WorkerPool &mWorkerPool;
+  MjpegHttpLoop *mHttpLoop;
+  RingFrame *mLoopFrame = nullptr;
+  std::mutex mProcessMutex;
+  std::condition_variable mProcessCondition;
+  bool mProcessScheduled = false;
+  time_t mLastScheduleTime = 0;
   std::unique_ptr<cv::VideoCapture> mVideoCapture;
+  std::unique_ptr<MjpegHttpStream> mMjpegStream;
+  std::unique_ptr<SyntheticSource> mSynthetic;
+  InStreamState mInStreamState = InStreamState::CONNECTING;
+  std::thread mConnectThread;
+  std::atomic_bool mConnectDone = false;
+  std::unique_ptr<cv::VideoCapture> mPendingVideoCapture;
+  std::unique_ptr<MjpegHttpStream> mPendingMjpegStream;
+  std::unique_ptr<SyntheticSource> mPendingSynthetic;
+  Backoff mBackoff;
+  uint64_t mNextConnectNs = 0;
+  std::vector<uchar> mGrabJpeg; // read into before a ring slot is taken
+  bool mPassthrough = false;
+  bool mMjpegHttpInput = false;
   std::unique_ptr<VideoOutStream> mOutStream = nullptr;
-  time_t mLastGrabTime = 0;
-  cv::Mat mLastGrabedFrame;
+  FrameRing mFrameRing;
+  Preprocessor mPreprocessor;
+  bool mMotionDetection = false;
+  bool mStillDetection = false;
+  MotionDetector mMotionDetector;
+  std::atomic<double> mMotionScore = 0;
+  std::atomic<uint64_t> mMotionFrames = 0;
+  StageCounter mGrabCounter;
+  StageCounter mDecodeCounter;
+  StageCounter mPreprocessCounter;
+  StageCounter mMotionCounter;
+  StageCounter mProcessCounter;
+  uint64_t mLastGrabNs = 0;
 };
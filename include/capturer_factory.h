@@ -1,12 +1,15 @@
 #pragma once
 
 #include "icapturer.h"
+#include "mjpeg_http_loop.h"
+#include "worker_pool.h"
 #include <memory>
 
 class CapturerFactory {
 public:
   static std::unique_ptr<ICapturer>
-  createCapturer(const CapturerParams &params);
+  createCapturer(const CapturerParams &params, WorkerPool &workerPool,
+                 MjpegHttpLoop &httpLoop);
 
 private:
   CapturerFactory() = default;
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ChunkRef {
+  std::string path;
+  std::string capturerName;
+  time_t startTime{0};
+  time_t endTime{0};
+  uint64_t sizeBytes{0};
+  bool active{false}; // still being recorded
+};
+
+// In-memory index of the record files ordered by chunk start time, with a
+// running byte total, so retention does not have to rescan the disk. The
+// chunks not being recorded are kept ordered separately, so the next one to
+// evict is found in constant time.
+class ChunkCatalog {
+public:
+  ChunkCatalog();
+
+  ~ChunkCatalog();
+
+  // replaces the entry with the same path
+  void add(const ChunkRef &ref);
+
+  bool remove(const std::string &path);
+
+  bool setSize(const std::string &path, uint64_t sizeBytes);
+
+  const ChunkRef *find(const std::string &path) const;
+
+  // oldest chunk that is not being recorded
+  const ChunkRef *oldest() const;
+
+  // same within the chunks of one capturer
+  const ChunkRef *oldest(const std::string &capturerName) const;
+
+  std::vector<std::string> capturers() const;
+
+  uint64_t capturerBytes(const std::string &capturerName) const;
+
+  const std::set<std::string> &activePaths() const;
+
+  uint64_t totalBytes() const;
+
+  size_t size() const;
+
+  void clear();
+
+private:
+  using Key = std::pair<time_t, std::string>;
+
+  struct CapturerIndex {
+    std::set<Key> keys;
+    std::set<Key> inactiveKeys; // the eviction order
+    uint64_t bytes{0};
+  };
+
+  std::map<Key, ChunkRef> mChunks;
+  std::set<Key> mInactiveKeys;
+  std::map<std::string, CapturerIndex> mCapturers;
+  std::unordered_map<std::string, time_t> mStartTimes;
+  std::set<std::string> mActivePaths;
+  uint64_t mTotalBytes = 0;
+};
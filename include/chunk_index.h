@@ -0,0 +1,82 @@
+#pragma once
+
+#include "globals.h"
+#include <unordered_map>
+
+constexpr char CHUNK_INDEX_FILE_NAME[] = ".chunk_index";
+
+struct ChunkIndexRecord {
+  int64_t startTime{0};
+  int64_t endTime{0};
+  uint64_t sizeBytes{0};
+  uint32_t frameCount{0};
+  uint32_t flags{0};
+  char fileName[96]{}; // relative to the capturer dir, zero terminated
+};
+
+static_assert(sizeof(ChunkIndexRecord) == 128, "index record layout");
+
+// Append-only file of fixed-size records of the finished chunks of one
+// capturer, memory-mapped for reading. Chunks close one after another so the
+// records are ordered by start time and time-range lookups binary search the
+// mapping. Removed chunks are only flagged, the file is compacted on open.
+class ChunkIndex {
+public:
+  static constexpr uint32_t FLAG_REMOVED = 1;
+
+  ChunkIndex();
+
+  ~ChunkIndex();
+
+  bool open(const std::string &dir);
+
+  bool isOpened() const;
+
+  bool append(const ChunkIndexRecord &record);
+
+  bool markRemoved(const std::string &fileName);
+
+  const ChunkIndexRecord *find(const std::string &fileName) const;
+
+  // live chunks overlapping [from, to)
+  void query(time_t from, time_t to,
+             std::vector<ChunkIndexRecord> &records) const;
+
+  // all records including the removed ones, in file order
+  size_t count() const;
+
+  const ChunkIndexRecord &at(size_t i) const;
+
+  void close();
+
+private:
+  ChunkIndex(const ChunkIndex &) = delete;
+
+  ChunkIndex &operator=(const ChunkIndex &) = delete;
+
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+  };
+
+  bool map();
+
+  void unmap();
+
+  bool compact();
+
+  const ChunkIndexRecord *records() const;
+
+  static constexpr uint32_t VERSION = 1;
+  static constexpr size_t MIN_MAP_SIZE = 65536;
+
+  std::string mPath;
+  int mFd = -1;
+  void *mMap = nullptr;
+  size_t mMapSize = 0;
+  size_t mCount = 0;
+  bool mSorted = true;
+  std::unordered_map<std::string, size_t> mFileNames;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ichunk_writer.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// chunk writer backed by cv::VideoWriter, encodes raw frames. The backend
+// encodes and writes the file in one call, so the frames are written behind
+// on the shared worker pool, one task per frame and in order per chunk, and
+// the file is synced on release. Frames of another size than the chunk (a
+// chunk downscaled under memory pressure) are resized there too.
+class CvChunkWriter : public IChunkWriter {
+public:
+  CvChunkWriter();
+
+  ~CvChunkWriter();
+
+  bool open(const ChunkWriterParams &params) override;
+
+  bool write(const VideoFrame &vf) override;
+
+  // the container has a fixed rate, the previous frame is encoded again
+  bool writeRepeat() override;
+
+  bool repeatsAreFree() const override { return false; }
+
+  void release() override;
+
+  // raw frames waiting for the encoder, newer ones are refused beyond. repeats
+  // are refused beyond as many slots of any kind
+  static constexpr uint32_t MAX_PENDING_FRAMES = 32;
+
+private:
+  struct PendingFrame {
+    VideoFrame vf;
+    uint32_t count{1};  // written this many times
+    uint64_t bytes{0};  // charged to the budget
+    bool raw{false};    // counts against MAX_PENDING_FRAMES
+  };
+
+  void schedule();
+
+  void encodeNext();
+
+  void writeFrame(const VideoFrame &vf, uint32_t count);
+
+  cv::VideoWriter mVideoWriter;
+  cv::Mat mDecodedFrame;
+  cv::Mat mScaledFrame;
+  cv::Size mFrameSize;
+  std::string mPath;
+  int mSyncFd = -1;
+  WorkerPool *mEncodePool = nullptr;
+  MemoryBudget *mMemoryBudget = nullptr;
+  StageCounter *mEncodeCounter = nullptr;
+
+  // the queue of one chunk, a single encode task is in flight at a time
+  std::mutex mMutex;
+  std::condition_variable mIdleCondition;
+  std::deque<PendingFrame> mPending;
+  uint32_t mPendingRaw = 0;
+  uint32_t mPendingSlots = 0; // repeats included
+  bool mEncoding = false;
+  VideoFrame mLastFrame; // the last one queued, for repeats
+};
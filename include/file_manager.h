@@ -1,22 +1,43 @@
 #pragma once
 
+#include "chunk_catalog.h"
+#include "chunk_index.h"
 #include "globals.h"
+#include "record_dir_watcher.h"
+#include "stage_counter.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <thread>
 
-struct FileRef {
-  std::string path;
-  std::string fileName;
-  int sizeMB{0};
+// zero disables a limit
+struct RetentionPolicy {
+  uint64_t maxBytes{0};
+  uint32_t maxAgeSec{0};
+  uint32_t minKeepSec{0}; // not evicted by the global limit before this age
 };
 
 struct FileManagerParams {
   std::string recordDir;
   int recordDirSizeLimitMB{0};
-  int recordDirSizeCheckIntervalSec{0};
   bool useLocalTime{false};
+  std::map<std::string, RetentionPolicy> retentionPolicies; // by capturer
+};
+
+struct FileManagerStats {
+  StageStats gc;
+  uint64_t evictedFiles{0};
+  uint64_t evictedBytes{0};
+  uint64_t recordFiles{0}; // in the catalog
+  uint64_t recordBytes{0};
 };
 
 constexpr char FILENAME_DELIMITIER = '#';
+constexpr char PREPARED_SUFFIX[] = ".part"; // of the chunks opened ahead
+constexpr int ACTIVE_CHECK_INTERVAL_MS = 2000;
+constexpr int RETENTION_CHECK_INTERVAL_MS = 60000;
 
 class FileManager {
 public:
@@ -34,6 +55,27 @@ public:
                                  const std::string &fileExtension,
                                  uint32_t chunkLengthSec, time_t t = 0) const;
 
+  // catalog hooks of the out-streams. a prepared chunk is created ahead of
+  // time under a temporary name and is not a record before it is opened
+  // under its real name
+  void chunkPrepared(const std::string &path);
+
+  void chunkDiscarded(const std::string &path);
+
+  void chunkOpened(const std::string &path,
+                   const std::string &preparedPath = std::string());
+
+  void chunkClosed(const std::string &path, const std::string &finalPath,
+                   uint32_t frameCount);
+
+  // finished and active chunks of a capturer overlapping [from, to)
+  std::vector<ChunkRef> findChunks(const std::string &capturerName,
+                                   time_t from, time_t to);
+
+  static bool parseRecordFile(const std::string &path, ChunkRef &ref);
+
+  FileManagerStats stats();
+
 private:
   FileManager() = default;
 
@@ -43,8 +85,40 @@ private:
 
   FileManager operator=(const FileManager &&) = delete;
 
+  void seedCatalog();
+
+  // true if the size came from the index
+  bool seedFile(const std::string &path, ChunkIndex *index,
+                const std::set<std::string> &active);
+
+  // stats the chunks being recorded, true if a size limit is crossed
+  bool updateActiveSizes();
+
+  void collectGarbage();
+
+  const ChunkRef *evictionCandidate(time_t now) const;
+
+  ChunkIndex *chunkIndex(const std::string &capturerName);
+
+  void unindex(const std::string &path);
+
+  // true if the catalog byte totals changed
+  bool applyEvents(const std::vector<WatchEvent> &events);
+
+  static std::string normalizePath(const std::string &path);
+
+  static bool isPreparedPath(const std::string &path);
+
   FileManagerParams mParams;
-  bool mExitFlag = false;
+  std::atomic<bool> mExitFlag = false;
+  RecordDirWatcher mWatcher;
+  std::mutex mCatalogMutex;
+  ChunkCatalog mCatalog;
+  std::set<std::string> mPreparedPaths;
+  std::map<std::string, std::unique_ptr<ChunkIndex>> mChunkIndexes;
+  bool mRetentionBlocked = false;
+  StageCounter mGcCounter;
+  std::atomic<uint64_t> mEvictedFiles = 0;
+  std::atomic<uint64_t> mEvictedBytes = 0;
   std::thread mGarbageCollectorThread;
-  time_t mLastCheckTime = 0;
 };
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "globals.h"
+#include <atomic>
+
+struct FramePoolStats {
+  uint32_t size{0};
+  uint64_t acquired{0};
+  uint64_t grown{0};
+  uint64_t exhausted{0};
+};
+
+// Pool of preallocated, fixed-geometry frame buffers. A buffer handed out by
+// acquire() is a regular cv::Mat header sharing the pooled data, so it goes
+// back to the pool as soon as the last header referring to it is released
+// (e.g. after the frame is encoded) without any explicit hand back.
+class FramePool {
+public:
+  FramePool();
+
+  ~FramePool();
+
+  bool init(const cv::Size &frameSize, int type, uint32_t initialCount,
+            uint32_t maxCount);
+
+  // never fails, falls back to an unpooled buffer when the pool is exhausted
+  cv::Mat acquire();
+
+  FramePoolStats stats() const;
+
+private:
+  FramePool(const FramePool &) = delete;
+
+  FramePool &operator=(const FramePool &) = delete;
+
+  static bool isFree(const cv::Mat &buffer);
+
+  cv::Size mFrameSize;
+  int mType = CV_8UC3;
+  uint32_t mMaxCount = 0;
+  std::vector<cv::Mat> mBuffers;
+  size_t mNextIndex = 0;
+
+  std::atomic<uint32_t> mSize = 0;
+  std::atomic<uint64_t> mAcquired = 0;
+  std::atomic<uint64_t> mGrown = 0;
+  std::atomic<uint64_t> mExhausted = 0;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+// Lays output frame slots at a fixed rate on the monotonic clock and picks
+// the input frame nearest in capture time to each of them, so padding or
+// thinning the in-stream to the output fps is decided frame by frame without
+// duplicating or erasing frames.
+class FrameResampler {
+public:
+  FrameResampler();
+
+  ~FrameResampler();
+
+  void reset(uint32_t fps, uint64_t originNs);
+
+  // true if the next unwritten slot lies before untilNs
+  bool hasSlotBefore(uint64_t untilNs) const;
+
+  uint64_t slotNs() const;
+
+  void advance();
+
+  // true if the frame captured at prevNs is at least as near to the current
+  // slot as the one captured at nextNs
+  bool preferPrev(uint64_t prevNs, uint64_t nextNs) const;
+
+  static uint64_t distanceNs(uint64_t aNs, uint64_t bNs);
+
+private:
+  uint32_t mFps = 1;
+  uint64_t mOriginNs = 0;
+  uint64_t mSlotIndex = 0;
+  uint64_t mSlotNs = 0;
+};
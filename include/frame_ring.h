@@ -0,0 +1,73 @@
+#pragma once
+
+#include "globals.h"
+#include <atomic>
+#include <memory>
+
+enum class OverflowPolicy { DROP_OLDEST, DROP_NEWEST };
+
+struct RingFrame {
+  cv::Mat frame;
+  std::vector<uchar> jpeg; // compressed payload when passing through
+  time_t time{0};
+  uint64_t timeNs{0};
+};
+
+struct FrameRingStats {
+  uint64_t pushed{0};
+  uint64_t popped{0};
+  uint64_t droppedOldest{0};
+  uint64_t droppedNewest{0};
+};
+
+// Fixed-capacity single-producer/single-consumer ring of reused frame
+// slots. The producer writes into a slot in place (acquireWrite/commitWrite)
+// and the consumer reads a slot in place (acquireRead/releaseRead), so slot
+// buffers are reused across frames and no locks are taken on either side.
+class FrameRing {
+public:
+  FrameRing();
+
+  ~FrameRing();
+
+  bool init(uint32_t capacity, OverflowPolicy policy);
+
+  // producer side: returns nullptr if the frame has to be dropped
+  RingFrame *acquireWrite();
+
+  void commitWrite();
+
+  // consumer side: returns nullptr if the ring is empty
+  RingFrame *acquireRead();
+
+  void releaseRead();
+
+  uint32_t size() const;
+
+  uint32_t capacity() const;
+
+  FrameRingStats stats() const;
+
+private:
+  FrameRing(const FrameRing &) = delete;
+
+  FrameRing &operator=(const FrameRing &) = delete;
+
+  static constexpr uint64_t NO_SLOT = UINT64_MAX;
+
+  // one spare slot keeps the consumer's in-flight slot out of the producer's
+  // reach while the ring is full
+  std::unique_ptr<RingFrame[]> mSlots;
+  uint32_t mSlotCount = 0;
+  uint32_t mCapacity = 0;
+  OverflowPolicy mPolicy = OverflowPolicy::DROP_OLDEST;
+
+  std::atomic<uint64_t> mHead = 0;
+  std::atomic<uint64_t> mTail = 0;
+  std::atomic<uint64_t> mReading = NO_SLOT;
+
+  std::atomic<uint64_t> mPushed = 0;
+  std::atomic<uint64_t> mPopped = 0;
+  std::atomic<uint64_t> mDroppedOldest = 0;
+  std::atomic<uint64_t> mDroppedNewest = 0;
+};
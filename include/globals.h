@@ -17,7 +17,8 @@ enum ExitCode : int {
   BAD_CAPTURER_COUNT = -4,
   BAD_FOURCC = -5,
   BAD_CAPTURER_TYPE = -6,
-  NO_CAPTURER = -6
+  NO_CAPTURER = -6,
+  BAD_WORKER_POOL = -7
 };
 
 static std::string timeString(time_t t, bool localTime = true) {
@@ -58,6 +59,12 @@ static uint64_t timeSinceEpochMs() {
       .count();
 }
 
+static uint64_t steadyTimeNs() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
 using Strings = std::vector<std::string>;
 static Strings split(const std::string &str, char delim) {
   Strings strings;
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "frame_ring.h"
+#include "motion_detector.h"
+#include "stage_counter.h"
+#include "synthetic_source.h"
 #include "video_out_stream.h"
 
 struct CapturerParams {
@@ -9,9 +13,34 @@ struct CapturerParams {
   uint32_t filterK = {0};
   bool flipX{false};
   bool flipY{false};
+  uint32_t preprocessThreads{1};
+  bool mjpegPassthrough{true};
+  bool mjpegHttpInput{true};
+  uint32_t stallTimeoutSec{2}; // without frames the in-stream is reconnected
+  uint32_t connectTimeoutMs{5000};
+  uint32_t reconnectMinMs{500}; // backoff bounds between attempts
+  uint32_t reconnectMaxMs{30000};
+  uint32_t ringCapacity{8};
+  OverflowPolicy ringOverflowPolicy{OverflowPolicy::DROP_OLDEST};
+  SyntheticSourceParams syntheticParams;
+  MotionDetectorParams motionDetectorParams;
   VideoOutStreamParams videoOutStreamParams;
 };
 
+struct CapturerStats {
+  StageStats grab;
+  StageStats decode;     // jpeg payloads that are not passed through
+  StageStats preprocess; // resize, filter and flip
+  StageStats motion;
+  StageStats process; // all of the above, per frame
+  FrameRingStats ring;
+  uint32_t ringDepth{0};
+  OutStreamStats out;
+  bool streamHealthy{false};
+  double motionScore{0};   // of the last frame
+  uint64_t motionFrames{0}; // frames above the motion threshold
+};
+
 class ICapturer {
 public:
   ICapturer() = default;
@@ -28,5 +57,10 @@ public:
 
   virtual bool isStreamHealthy() const = 0;
 
+  // starts or extends an event clip in event record mode
+  virtual void triggerEvent() = 0;
+
+  virtual CapturerStats stats() const = 0;
+
   virtual CapturerParams &params() = 0;
 };
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "io_worker.h"
+#include "memory_budget.h"
+#include "stage_counter.h"
+#include "video_frame.h"
+#include "worker_pool.h"
+
+struct ChunkWriterParams {
+  std::string path;
+  char fourcc[4]{'m', 'j', 'p', 'g'};
+  double fps{10};
+  cv::Size frameSize;
+  IoWorker *ioWorker{nullptr}; // write-behind thread, inline writes if null
+  WorkerPool *encodePool{nullptr}; // encoding, inline if null
+  MemoryBudget *memoryBudget{nullptr}; // charged for the queued writes
+  StageCounter *encodeCounter{nullptr}; // per queued frame, re-encoding only
+  uint32_t bufferBytes{1 << 20};
+  uint32_t syncIntervalSec{0}; // fdatasync cadence, on release only if 0
+  uint64_t preallocateBytes{0};
+  uint32_t fragmentSec{0}; // fragmented containers only
+};
+
+class IChunkWriter {
+public:
+  IChunkWriter() = default;
+
+  virtual ~IChunkWriter(){};
+
+  virtual bool open(const ChunkWriterParams &params) = 0;
+
+  virtual bool write(const VideoFrame &vf) = 0;
+
+  // shows the previous frame for one more frame interval without storing it
+  // again, false if the container cannot express that
+  virtual bool writeRepeat() { return false; }
+
+  // a repeat costs neither an encode nor a stored frame
+  virtual bool repeatsAreFree() const { return true; }
+
+  virtual void release() = 0;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "task.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Single background thread running blocking file work in submission order,
+// so it never holds up the frame path. Tasks submitted by a task run inline
+// and stop() finishes the queued tasks.
+class IoWorker {
+public:
+  IoWorker();
+
+  IoWorker(const IoWorker &) = delete;
+
+  IoWorker &operator=(const IoWorker &) = delete;
+
+  ~IoWorker();
+
+  bool init();
+
+  void submit(Task &&task);
+
+  void stop();
+
+  uint32_t pendingTasks() const;
+
+private:
+  void workerLoop();
+
+  std::deque<Task> mTasks;
+  mutable std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::thread mThread;
+  bool mExitFlag = false;
+};
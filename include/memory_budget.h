@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+struct MemoryBudgetStats {
+  uint64_t usedBytes{0};
+  uint64_t peakBytes{0};
+  uint64_t limitBytes{0}; // 0 if unlimited
+};
+
+// Byte accounting of the frame data waiting for the disk, optionally nested
+// in a parent budget (a stream's in the global one). Charges never fail, as
+// a handed off write can not be taken back, the frame path looks at the
+// pressure instead and sheds frames before anything is queued.
+class MemoryBudget {
+public:
+  MemoryBudget();
+
+  MemoryBudget(const MemoryBudget &) = delete;
+
+  MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+  void init(uint64_t limitBytes, MemoryBudget *parent = nullptr);
+
+  // thread safe, the io worker releases what the frame path charged
+  void charge(uint64_t bytes);
+
+  void release(uint64_t bytes);
+
+  // used share of the limit, the highest one up to the root
+  double pressure() const;
+
+  MemoryBudgetStats stats() const;
+
+private:
+  uint64_t mLimitBytes = 0;
+  MemoryBudget *mParent = nullptr;
+  std::atomic<uint64_t> mUsedBytes = 0;
+  std::atomic<uint64_t> mPeakBytes = 0;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "file_manager.h"
+#include "icapturer.h"
+#include "memory_budget.h"
+
+struct CapturerMetrics {
+  std::string name;
+  CapturerStats stats;
+};
+
+// Prometheus text exposition (version 0.0.4) of the capturer and file
+// manager stats. Stage latencies are folded from the fine grained buckets
+// into a short fixed list of histogram bounds.
+class MetricsRenderer {
+public:
+  static std::string render(const std::vector<CapturerMetrics> &capturers,
+                            const FileManagerStats &fileManager,
+                            const MemoryBudgetStats &memory);
+
+private:
+  MetricsRenderer() = default;
+
+  static void family(std::string &out, const char *name, const char *type,
+                     const char *help);
+
+  static void sample(std::string &out, const char *name,
+                     const std::string &labels, double value);
+
+  static void histogram(std::string &out, const char *name,
+                        const std::string &labels, const StageStats &s);
+
+  static std::string label(const char *key, const std::string &value);
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "globals.h"
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// Minimal local http endpoint answering "GET /metrics" with the text of the
+// renderer, one connection at a time on its own thread. Rendering happens
+// per scrape, the recording path only keeps its counters.
+class MetricsServer {
+public:
+  using Renderer = std::function<std::string()>;
+
+  MetricsServer();
+
+  MetricsServer(const MetricsServer &) = delete;
+
+  MetricsServer &operator=(const MetricsServer &) = delete;
+
+  ~MetricsServer();
+
+  bool init(const std::string &address, uint16_t port, Renderer &&renderer);
+
+  void stop();
+
+private:
+  void serveLoop();
+
+  void serve(int client);
+
+  Renderer mRenderer;
+  int mSocket = -1;
+  int mWakeFds[2] = {-1, -1};
+  std::thread mThread;
+  std::atomic_bool mExitFlag = false;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ichunk_writer.h"
+#include "segment_file.h"
+
+// Minimal AVI (RIFF) muxer for motion jpeg. Jpeg payloads are stored as they
+// are, so passed through frames are recorded without decoding; raw frames
+// are jpeg encoded first.
+class MjpegAviWriter : public IChunkWriter {
+public:
+  MjpegAviWriter();
+
+  ~MjpegAviWriter();
+
+  bool open(const ChunkWriterParams &params) override;
+
+  bool write(const VideoFrame &vf) override;
+
+  bool writeRepeat() override;
+
+  void release() override;
+
+  static constexpr int JPEG_QUALITY = 90;
+
+private:
+  bool writeFrameChunk(const uchar *data, size_t size);
+
+  void writeHeaders();
+
+  void putU32(uint32_t v);
+
+  void putU16(uint16_t v);
+
+  void putU8(uint8_t v);
+
+  void putFourcc(const char *fourcc);
+
+  void patchU32(uint64_t offset, uint32_t v);
+
+  SegmentFile mFile;
+  double mFps = 10;
+  cv::Size mFrameSize;
+  uint32_t mFrameCount = 0;
+  uint32_t mMaxFrameSize = 0;
+  uint64_t mMoviOffset = 0;
+  uint64_t mTotalFramesOffset = 0;
+  uint64_t mLengthOffset = 0;
+  uint64_t mSuggestedBufferOffset = 0;
+  std::vector<uint32_t> mIndex; // offset, size pairs relative to movi
+  std::vector<uchar> mEncodeBuffer;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "backoff.h"
+#include "globals.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Receiver of the jpeg payloads of one stream, called on the loop thread.
+class IMjpegSink {
+public:
+  virtual ~IMjpegSink() = default;
+
+  // buffer for the next payload, nullptr drops it
+  virtual std::vector<uchar> *acquireJpeg() = 0;
+
+  // the acquired buffer is filled, busyNs is the loop time spent on it
+  virtual void commitJpeg(uint64_t busyNs) = 0;
+
+  // about once a second, with or without frames
+  virtual void tick() = 0;
+
+  virtual void streamChanged(bool healthy) = 0;
+};
+
+struct MjpegHttpSourceParams {
+  std::string name;
+  std::string uri;
+  uint32_t connectTimeoutMs{5000};
+  uint32_t stallTimeoutSec{2};
+  uint32_t reconnectMinMs{500};
+  uint32_t reconnectMaxMs{30000};
+};
+
+// One epoll thread reading any number of multipart/x-mixed-replace mjpeg
+// streams. Part headers are parsed in place in the receive buffer and a part
+// with a content-length is received straight into the sink's buffer. Each
+// stream reconnects on its own with backoff, a dead camera only costs a
+// timer.
+class MjpegHttpLoop {
+public:
+  MjpegHttpLoop();
+
+  MjpegHttpLoop(const MjpegHttpLoop &) = delete;
+
+  MjpegHttpLoop &operator=(const MjpegHttpLoop &) = delete;
+
+  ~MjpegHttpLoop();
+
+  // the loop thread is started with the first stream
+  bool add(IMjpegSink *sink, const MjpegHttpSourceParams &params);
+
+  // the sink is not called anymore once this returns
+  void remove(IMjpegSink *sink);
+
+  void stop();
+
+private:
+  enum class State {
+    BACKOFF,
+    CONNECTING,
+    REQUEST,
+    HEADERS,
+    BOUNDARY,
+    PART_HEADERS,
+    BODY,
+    SCAN_BODY
+  };
+
+  struct Source {
+    IMjpegSink *sink = nullptr;
+    MjpegHttpSourceParams params;
+    std::string host;
+    std::string port;
+    std::string request;
+    int fd = -1;
+    State state = State::BACKOFF;
+    uint64_t deadlineNs = 0; // of the connect, stall or backoff
+    Backoff backoff;
+    bool healthy = false;
+    bool unsupported = false;
+    std::string boundary;
+    std::string delimiter; // set by the first part
+    std::vector<char> buffer;
+    size_t begin = 0;
+    size_t end = 0;
+    size_t sent = 0;
+    std::vector<uchar> *payload = nullptr;
+    size_t payloadSize = 0;
+    size_t payloadFill = 0;
+    uint64_t payloadBusyNs = 0;
+    uint64_t receiveStartNs = 0;
+  };
+
+  bool start();
+
+  void wakeUp();
+
+  void loop();
+
+  void applyChanges();
+
+  void connect(Source &s);
+
+  void fail(Source &s, const char *reason);
+
+  void handleEvent(Source &s, uint32_t events);
+
+  bool sendRequest(Source &s);
+
+  bool receive(Source &s);
+
+  bool parse(Source &s);
+
+  bool parseResponse(Source &s, const char *headersEnd);
+
+  void beginPayload(Source &s, const char *headersEnd);
+
+  void commitPayload(Source &s);
+
+  void closeSource(Source &s);
+
+  static constexpr size_t MAX_PART_SIZE = 16 * 1048576;
+  static constexpr size_t MAX_HEADERS_SIZE = 65536;
+  static constexpr size_t READ_SIZE = 65536;
+
+  std::vector<std::unique_ptr<Source>> mSources;
+  int mEpollFd = -1;
+  int mWakeFd = -1;
+  std::thread mThread;
+  std::atomic_bool mExitFlag = false;
+  time_t mLastTickTime = 0;
+
+  // changes handed to the loop thread
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::vector<std::unique_ptr<Source>> mAdded;
+  std::vector<IMjpegSink *> mRemoved;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "globals.h"
+
+// Blocking reader for multipart/x-mixed-replace mjpeg streams served over
+// http (e.g. esp32-cam ".../stream" endpoints). Hands out the jpeg payload of
+// every part as is, without decoding it.
+class MjpegHttpStream {
+public:
+  MjpegHttpStream();
+
+  ~MjpegHttpStream();
+
+  bool open(const std::string &uri, int timeoutMs = 5000);
+
+  bool isOpened() const;
+
+  // bounds a read() on a stalled stream, the open timeout by default
+  void setReadTimeout(int timeoutMs);
+
+  // true if the last open() reached the server, but it does not serve a
+  // multipart stream
+  bool isUnsupported() const;
+
+  bool read(std::vector<uchar> &jpeg);
+
+  void close();
+
+  static bool parseUri(const std::string &uri, std::string &host,
+                       std::string &port, std::string &path);
+
+  // frame size from the jpeg SOF header, without decoding
+  static bool jpegSize(const std::vector<uchar> &jpeg, cv::Size &size);
+
+private:
+  bool fill();
+
+  size_t find(const std::string &token, size_t from) const;
+
+  // "--" + boundary, the bare token only if the server leaves the dashes out,
+  // as the bare one may well occur in the jpeg data
+  size_t findDelimiter(size_t from);
+
+  bool readHeaders(std::string &headers);
+
+  static std::string headerValue(const std::string &headers,
+                                 const std::string &key);
+
+  static constexpr size_t MAX_PART_SIZE = 16 * 1048576;
+
+  int mSocket = -1;
+  bool mUnsupported = false;
+  std::string mBoundary;
+  std::string mDelimiter; // set by the first part
+  std::vector<char> mBuffer;
+  size_t mBegin = 0;
+  size_t mEnd = 0;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "globals.h"
+
+struct MotionDetectorParams {
+  uint32_t scale{8};           // thumbnail is 1/scale of the frame per side
+  uint32_t pixelThreshold{25}; // gray level change of a moving pixel
+  double areaThreshold{0.01};  // moving pixel ratio of a motion frame
+  double learningRate{0.05};   // background adaption per frame
+  double stillThreshold{0.002}; // changed pixel ratio of a still frame
+};
+
+// Frame differencing against a running average background on a small gray
+// thumbnail. The thumbnail is sampled straight from the output frame (or
+// dct-scale decoded from a jpeg), so a frame costs about 1/scale^2 of a
+// full frame pass. Besides motion against the background it tells still
+// frames, compared to the last frame that was not still, so slow changes
+// add up instead of going unnoticed.
+class MotionDetector {
+public:
+  MotionDetector();
+
+  ~MotionDetector();
+
+  bool init(const MotionDetectorParams &params);
+
+  // ratio of moving pixels, 0 on the first frame
+  double update(const cv::Mat &frame);
+
+  double updateEncoded(const std::vector<uchar> &jpeg);
+
+  bool isMotion(double score) const;
+
+  // the last frame barely differs from the last distinct one
+  bool isStill() const;
+
+private:
+  double updateThumbnail();
+
+  void sampleThumbnail(const cv::Mat &frame);
+
+  // pixels differing by more than the pixel threshold
+  uint32_t countChanged(const cv::Mat &cur, const cv::Mat &ref);
+
+  MotionDetectorParams mParams;
+  cv::Mat mThumbnail;
+  cv::Mat mBackground;     // running average, float gray levels
+  cv::Mat mBackgroundGray; // the same rounded to 8 bit for the difference
+  cv::Mat mDiff;
+  cv::Mat mReference; // thumbnail of the last distinct frame
+  bool mStill = false;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ichunk_writer.h"
+#include "segment_file.h"
+
+// Fragmented MP4 (ISO BMFF) muxer for motion jpeg. The init segment is
+// written on open and every fragmentSec a self-contained moof/mdat pair is
+// appended and synced, so a chunk is playable up to its last fragment at any
+// time, e.g. after a power cut or while still being recorded. Repeated frames
+// only lengthen the previous sample, so the frame rate is variable.
+class Mp4FragmentWriter : public IChunkWriter {
+public:
+  Mp4FragmentWriter();
+
+  ~Mp4FragmentWriter();
+
+  bool open(const ChunkWriterParams &params) override;
+
+  bool write(const VideoFrame &vf) override;
+
+  bool writeRepeat() override;
+
+  void release() override;
+
+  static constexpr uint32_t TIMESCALE = 90000;
+
+private:
+  bool addSample(const uchar *data, size_t size);
+
+  bool writeFragment();
+
+  void writeInitSegment();
+
+  // boxes are built in mBox, nested boxes get their size on end
+  size_t beginBox(const char *type);
+
+  size_t beginFullBox(const char *type, uint8_t version, uint32_t flags);
+
+  void endBox(size_t pos);
+
+  void put(const void *data, size_t size);
+
+  void putU8(uint8_t v);
+
+  void putU16(uint16_t v);
+
+  void putU32(uint32_t v);
+
+  void putU64(uint64_t v);
+
+  void patchU32(size_t pos, uint32_t v);
+
+  SegmentFile mFile;
+  cv::Size mFrameSize;
+  uint32_t mSampleDuration = TIMESCALE / 10;
+  uint64_t mFragmentDuration = TIMESCALE;
+  uint64_t mPendingDuration = 0;
+  uint32_t mSequence = 0;
+  uint64_t mDecodeTime = 0;
+  std::vector<uint32_t> mSampleSizes;
+  std::vector<uint32_t> mSampleDurations; // repeats lengthen a sample
+  std::vector<uchar> mSamples;
+  std::vector<uchar> mBox;
+  std::vector<uchar> mEncodeBuffer;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "video_frame.h"
+#include <deque>
+
+// Ring of the most recent encoded output frames, bounded by total payload
+// bytes and by frame count. Between events it holds the lead-in that is
+// written ahead of the next event clip.
+class PreEventBuffer {
+public:
+  PreEventBuffer();
+
+  ~PreEventBuffer();
+
+  void init(uint64_t maxBytes, uint32_t maxFrames);
+
+  // frames without an encoded payload are ignored
+  void push(VideoFrame &&vf);
+
+  // oldest first
+  bool pop(VideoFrame &vf);
+
+  bool empty() const;
+
+  uint64_t bytes() const;
+
+  void clear();
+
+private:
+  std::deque<VideoFrame> mFrames;
+  uint64_t mBytes = 0;
+  uint64_t mMaxBytes = 0;
+  uint32_t mMaxFrames = 0;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "globals.h"
+
+struct PreprocessorParams {
+  cv::Size outputSize{1024, 768};
+  uint32_t filterK{0};
+  bool flipX{false};
+  bool flipY{false};
+  uint32_t stripeRows{64};
+  uint32_t threads{1};
+};
+
+// Fused resize + median filter + flip. The flip is folded into the resize
+// coordinate maps and the frame is processed in stripes of rows (with a
+// halo for the median filter), so every stripe is resized, filtered and
+// stored while it is still in the cache instead of three full frame passes.
+class Preprocessor {
+public:
+  Preprocessor();
+
+  ~Preprocessor();
+
+  bool init(const PreprocessorParams &params);
+
+  void process(const cv::Mat &src, cv::Mat &dst);
+
+private:
+  void buildMaps(const cv::Size &srcSize);
+
+  void processStripe(const cv::Mat &src, cv::Mat &dst, int y0, int y1) const;
+
+  PreprocessorParams mParams;
+  int mKernelSize = 0;
+  bool mFlipRows = false;
+  bool mFlipCols = false;
+  cv::Size mMapSrcSize;
+  bool mIdentity = false;
+  cv::Mat mMap1; // fixed point source coordinates
+  cv::Mat mMap2; // interpolation table indices
+};
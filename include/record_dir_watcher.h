@@ -0,0 +1,53 @@
+#pragma once
+
+#include "globals.h"
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+
+enum class WatchEventType { CHANGED, REMOVED, OVERFLOW };
+
+struct WatchEvent {
+  WatchEventType type{WatchEventType::CHANGED};
+  std::string path;
+};
+
+// Recursive inotify watch over the record directory. New subdirectories are
+// watched as they appear and their files are reported as changed. Platforms
+// without inotify get no events, wait() then only times out or wakes up.
+class RecordDirWatcher {
+public:
+  RecordDirWatcher();
+
+  ~RecordDirWatcher();
+
+  bool init(const std::string &dir);
+
+  bool isOpened() const;
+
+  // blocks till events arrive, wakeUp() is called or the timeout expires,
+  // a negative timeout waits forever
+  void wait(int timeoutMs, std::vector<WatchEvent> &events);
+
+  void wakeUp();
+
+  void close();
+
+private:
+  RecordDirWatcher(const RecordDirWatcher &) = delete;
+
+  RecordDirWatcher &operator=(const RecordDirWatcher &) = delete;
+
+  void addWatch(const std::string &dir, std::vector<WatchEvent> &events);
+
+  void readEvents(std::vector<WatchEvent> &events);
+
+  int mInotifyFd = -1;
+  int mWakeFds[2] = {-1, -1};
+  std::unordered_map<int, std::string> mWatchDirs;
+
+  // fallback wake up without inotify
+  bool mWakeUpFlag = false;
+  std::mutex mWakeMutex;
+  std::condition_variable mWakeCondition;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ichunk_writer.h"
+#include <atomic>
+
+// Write-behind output file of the muxers. Bytes are collected in memory and
+// handed to the io worker in large block aligned writes, fdatasync is issued
+// at the configured cadence and the expected size can be reserved up front.
+// Already handed off bytes can still be patched, e.g. container headers.
+class SegmentFile {
+public:
+  SegmentFile();
+
+  ~SegmentFile();
+
+  bool open(const ChunkWriterParams &params);
+
+  bool isOpened() const;
+
+  // no write has failed so far
+  bool good() const;
+
+  bool write(const void *data, size_t size);
+
+  bool patch(uint64_t offset, const void *data, size_t size);
+
+  uint64_t tell() const;
+
+  // hands off everything written so far and syncs it
+  void sync();
+
+  // flushes and syncs the rest, false if any write failed
+  bool close();
+
+  static constexpr size_t BLOCK_SIZE = 4096;
+
+private:
+  SegmentFile(const SegmentFile &) = delete;
+
+  SegmentFile &operator=(const SegmentFile &) = delete;
+
+  struct Sink {
+    ~Sink();
+
+    int fd{-1};
+    uint32_t syncIntervalSec{0};
+    uint64_t lastSyncNs{0};
+    bool preallocated{false};
+    std::atomic<bool> failed{false};
+  };
+
+  void flush(bool all);
+
+  static void writeAt(Sink &sink, const uchar *data, size_t size,
+                      uint64_t offset);
+
+  std::shared_ptr<Sink> mSink;
+  IoWorker *mIoWorker = nullptr;
+  MemoryBudget *mMemoryBudget = nullptr;
+  std::vector<uchar> mBuffer; // bytes from mBufferOffset on
+  uint64_t mBufferOffset = 0;
+  uint32_t mBufferBytes = 0;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Log-linear latency buckets, four per power of two, so a percentile read
+// from them is off by less than a fifth.
+constexpr uint32_t LATENCY_SUB_BUCKETS = 4;
+constexpr uint32_t LATENCY_BUCKETS = 63 * LATENCY_SUB_BUCKETS;
+
+inline uint32_t latencyBucket(uint64_t ns) {
+  if (ns < LATENCY_SUB_BUCKETS) {
+    return static_cast<uint32_t>(ns);
+  }
+
+  const uint32_t msb = 63 - __builtin_clzll(ns);
+  const uint32_t sub = (ns >> (msb - 2)) & (LATENCY_SUB_BUCKETS - 1);
+  return (msb - 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+// upper bound of the bucket
+inline uint64_t latencyBucketNs(uint32_t bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS) {
+    return bucket;
+  }
+
+  const uint32_t msb = bucket / LATENCY_SUB_BUCKETS + 1;
+  const uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+  return ((LATENCY_SUB_BUCKETS + sub + 1) << (msb - 2)) - 1;
+}
+
+struct StageStats {
+  uint64_t frames{0};
+  uint64_t busyNs{0};
+  uint64_t lastNs{0};
+  std::vector<uint64_t> latency; // frames by latency bucket
+
+  // p in [0, 1]
+  uint64_t percentileNs(double p) const {
+    uint64_t total = 0;
+    for (uint64_t n : latency) {
+      total += n;
+    }
+
+    const uint64_t rank = static_cast<uint64_t>(p * total);
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < latency.size(); ++b) {
+      seen += latency[b];
+      if (seen > rank) {
+        return latencyBucketNs(b);
+      }
+    }
+    return 0;
+  }
+};
+
+// Per-stage frame counter updated from the hot path without locks.
+struct StageCounter {
+  std::atomic<uint64_t> frames = 0;
+  std::atomic<uint64_t> busyNs = 0;
+  std::atomic<uint64_t> lastNs = 0;
+  std::atomic<uint64_t> latency[LATENCY_BUCKETS] = {};
+
+  void add(uint64_t ns) {
+    frames.fetch_add(1, std::memory_order_relaxed);
+    busyNs.fetch_add(ns, std::memory_order_relaxed);
+    lastNs.store(ns, std::memory_order_relaxed);
+    latency[latencyBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  StageStats snapshot() const {
+    StageStats s;
+    s.frames = frames.load(std::memory_order_relaxed);
+    s.busyNs = busyNs.load(std::memory_order_relaxed);
+    s.lastNs = lastNs.load(std::memory_order_relaxed);
+    s.latency.resize(LATENCY_BUCKETS);
+    for (uint32_t b = 0; b < LATENCY_BUCKETS; ++b) {
+      s.latency[b] = latency[b].load(std::memory_order_relaxed);
+    }
+    return s;
+  }
+};
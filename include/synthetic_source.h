@@ -0,0 +1,40 @@
+#pragma once
+
+#include "globals.h"
+
+struct SyntheticSourceParams {
+  cv::Size frameSize{1280, 720};
+  uint32_t fps{10}; // 0 hands out frames as fast as they are read
+  std::string file; // replayed in a loop, test pattern if empty
+};
+
+// Camera stand-in for benchmarks and tests: a moving test pattern, or the
+// first frames of a local video file replayed in a loop. The frames are
+// prepared up front, so reading costs no more than a copy.
+class SyntheticSource {
+public:
+  SyntheticSource();
+
+  ~SyntheticSource();
+
+  bool open(const SyntheticSourceParams &params);
+
+  bool isOpened() const;
+
+  // blocks till the next frame is due
+  void wait();
+
+  bool read(cv::Mat &frame);
+
+private:
+  bool loadFile();
+
+  void makePattern();
+
+  static constexpr uint32_t MAX_REPLAY_FRAMES = 100;
+
+  SyntheticSourceParams mParams;
+  std::vector<cv::Mat> mFrames;
+  uint64_t mFrameCount = 0;
+  uint64_t mNextNs = 0;
+};
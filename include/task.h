@@ -0,0 +1,6 @@
+#pragma once
+
+#include <functional>
+
+// unit of work of the worker pool and the io workers
+using Task = std::function<void()>;
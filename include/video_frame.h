@@ -0,0 +1,18 @@
+#pragma once
+
+#include "globals.h"
+#include <memory>
+
+// compressed frame payload (a jpeg image for mjpeg), shared between the
+// output slots it is written to
+using EncodedFrame = std::shared_ptr<const std::vector<uchar>>;
+
+struct VideoFrame {
+  cv::Mat frame;
+  EncodedFrame encoded; // set instead of frame when passed through
+  time_t time{0};       // wall clock, used for labels and file names
+  uint64_t timeNs{0};   // monotonic capture time, used for the output timing
+  bool still{false};    // next to no change since the last distinct frame
+
+  bool empty() const { return frame.empty() && !encoded; }
+};
@@ -1,12 +1,27 @@
 #pragma once
 
+#include "frame_pool.h"
+#include "frame_resampler.h"
 #include "globals.h"
-#include <queue>
+#include "ichunk_writer.h"
+#include "io_worker.h"
+#include "memory_budget.h"
+#include "pre_event_buffer.h"
+#include "stage_counter.h"
+#include "video_frame.h"
+#include "watermark.h"
+#include <atomic>
 
-struct VideoFrame {
-  cv::Mat frame;
-  time_t time;
-};
+// event: chunks only around triggered events, motion: events come from the
+// motion detector, motion_fps: continuous at idle fps boosted on motion. The
+// idle slots hold a frame, they only take less space with adaptive_fps on a
+// passthrough or fragmented stream, each of them is stored in full otherwise
+enum class RecordMode { CONTINUOUS, EVENT, MOTION, MOTION_FPS };
+
+// what goes first while the queued writes are over half of the budget,
+// frames are dropped at the budget whatever the policy. downscale encodes
+// the chunks opened meanwhile at half the size, re-encoded output only
+enum class ShedPolicy { DROP_FRAMES, LOWER_FPS, DOWNSCALE };
 
 struct VideoOutStreamParams {
   std::string name;
@@ -17,7 +32,58 @@ struct VideoOutStreamParams {
   char fourcc[4]{'m', 'j', 'p', 'g'};
   std::string fileExtension;
   bool watermark{true};
+  WatermarkParams watermarkParams;
   bool useLocaltime{true};
+  bool passthrough{false}; // jpeg payloads are muxed without re-encoding
+  uint32_t writeBufferBytes{1 << 20};
+  uint32_t syncIntervalSec{5};
+  bool preallocate{true};
+  uint32_t fragmentSec{0}; // fragmented mp4 for mjpg if set
+  RecordMode recordMode{RecordMode::CONTINUOUS};
+  uint32_t preEventSec{5};
+  uint64_t preEventBytes{8 << 20};
+  uint32_t postEventSec{10};
+  uint32_t idleFps{1}; // 1 up to fps
+  bool adaptiveFps{false}; // still frames as repeats where they are free
+  uint32_t adaptiveMinFps{1}; // 1 up to fps
+  uint64_t queueBudgetBytes{32 << 20}; // 0 if unlimited
+  MemoryBudget *memoryBudget{nullptr}; // shared by the streams
+  WorkerPool *workerPool{nullptr};     // encoding, inline if null
+  ShedPolicy shedPolicy{ShedPolicy::DROP_FRAMES};
+};
+
+struct OutStreamStats {
+  uint64_t freshSlots{0};      // slots showing a frame the first time
+  uint64_t duplicatedSlots{0}; // slots showing the previous frame again
+  uint64_t blankSlots{0};
+  uint64_t droppedFrames{0};  // frames no slot was picked for
+  uint64_t repeatedFrames{0}; // slots stored as repeats
+  uint64_t backloggedFrames{0}; // left out as the writer queue was full
+  uint64_t chunks{0};
+  uint32_t ioQueueDepth{0};
+  uint64_t preEventBytes{0};
+  uint64_t queueBytes{0}; // frame data waiting for the disk
+  uint64_t shedFrames{0}; // not stored for the memory budget
+  uint64_t thinnedFrames{0};
+  uint64_t downscaledFrames{0};
+  StageStats watermark;
+  StageStats write;  // handing a frame to the writer, repeats excluded
+  StageStats encode; // decoding and re-encoding on the worker pool
+  StageStats rotate;
+  StageStats finalize; // on the io worker
+};
+
+struct OutChunk {
+  std::unique_ptr<IChunkWriter> writer;
+  std::string path;
+  std::string preparedPath; // created under, renamed to path when adopted
+  time_t namedStartTime{0}; // as in the file name
+  time_t startTime{0};      // of the first written slot
+  time_t lastWriteTime{0};
+  uint32_t writtenFrames{0};  // slots, repeats included
+  uint32_t repeatedFrames{0}; // slots without a stored frame
+  uint32_t skippedSlots{0};   // slots left out of the file
+  bool downscaled{false};     // encoded at half the output size
 };
 
 class VideoOutStream {
@@ -28,25 +94,114 @@ public:
 
   bool init(const VideoOutStreamParams &params);
 
-  void update(const time_t t);
+  void update(const uint64_t tNs);
+
+  void feed(cv::Mat &&frame, const time_t t, const uint64_t tNs,
+            const bool still = false);
+
+  void feedEncoded(EncodedFrame &&encoded, const time_t t, const uint64_t tNs,
+                   const bool still = false);
 
-  void feed(cv::Mat &&frame, const time_t t);
+  cv::Mat acquireFrame();
+
+  FramePoolStats framePoolStats() const;
+
+  OutStreamStats stats() const;
+
+  // records from the pre-event frames till postEventSec after t
+  void triggerEvent(const time_t t);
+
+  static RecordMode parseRecordMode(const std::string &mode);
+
+  static ShedPolicy parseShedPolicy(const std::string &policy);
 
   VideoOutStreamParams &params();
 
 private:
-  void processQueueForTime(const time_t t);
+  void enqueue(VideoFrame &&vf);
+
+  void writeSlotsBefore(const uint64_t tNs, const VideoFrame *next);
+
+  void writeSlot(const VideoFrame &vf, const time_t t);
+
+  void writeChunkFrame(const VideoFrame &vf);
+
+  bool shedChunkFrame();
+
+  void skipChunkFrame();
+
+  bool isRecording(const time_t t) const;
+
+  bool isEventMode() const;
+
+  void bufferSlot(const VideoFrame &vf, const time_t t);
+
+  const VideoFrame &blankFrame(const time_t t);
 
   void watermarkFrame(cv::Mat &frame, const time_t t);
 
-  bool beginChunk(const time_t t);
+  bool rotateChunk(const time_t t);
+
+  void adoptChunk(std::unique_ptr<OutChunk> &&chunk, const time_t t);
 
   bool releaseChunk();
 
+  // run on the io worker
+  std::unique_ptr<OutChunk> openChunk(const time_t t);
+
+  void finalizeChunk(OutChunk &chunk);
+
+  void prepareChunk(const time_t t);
+
+  std::unique_ptr<OutChunk> takeNextChunk();
+
+  time_t nextChunkTime(const time_t t) const;
+
   VideoOutStreamParams mParams;
-  uint32_t mWrittenFramesCount = 0;
   time_t mLastWriteTime = 0;
-  std::unique_ptr<cv::VideoWriter> mVideoWriter;
-  std::queue<VideoFrame> mFrameQueue;
-  std::string mCurrentVideoFile;
+  time_t mLastChunkAttemptTime = 0;
+  bool mRotatePending = false;
+  bool mFragmented = false;
+  int64_t mWallOffsetNs = 0;
+  OutChunk mChunk;
+  IoWorker mIoWorker;
+  MemoryBudget mMemoryBudget; // of the queued writes
+  uint32_t mThinSlots = 0;
+  bool mNextChunkRequested = false;
+  bool mNextChunkDone = false;
+  std::unique_ptr<OutChunk> mNextChunk;
+  std::mutex mNextChunkMutex;
+  std::atomic<uint64_t> mAvgFrameBytes = 0; // of the last finished chunk
+  std::atomic<time_t> mRecordUntil = 0;
+  PreEventBuffer mPreEvent;
+  VideoFrame mHeldFrame; // shown between idle fps refreshes
+  uint32_t mIdleSlots = 0;
+  uint64_t mLastWrittenNs = 0; // the frame shown by the chunk
+  time_t mLastWrittenTime = 0;
+  uint32_t mRepeatedSlots = 0;
+  FramePool mFramePool;
+  bool mLastFrameUsed = false; // by a slot
+  bool mNextFrameUsed = false;
+
+  // metrics, written by the frame path only
+  std::atomic<uint64_t> mFreshSlots = 0;
+  std::atomic<uint64_t> mDuplicatedSlots = 0;
+  std::atomic<uint64_t> mBlankSlots = 0;
+  std::atomic<uint64_t> mDroppedFrames = 0;
+  std::atomic<uint64_t> mRepeatedFrames = 0;
+  std::atomic<uint64_t> mBackloggedFrames = 0;
+  std::atomic<uint64_t> mChunks = 0;
+  std::atomic<uint64_t> mPreEventBytes = 0;
+  std::atomic<uint64_t> mShedFrames = 0;
+  std::atomic<uint64_t> mThinnedFrames = 0;
+  std::atomic<uint64_t> mDownscaledFrames = 0;
+  StageCounter mWatermarkCounter;
+  StageCounter mWriteCounter;
+  StageCounter mEncodeCounter;
+  StageCounter mRotateCounter;
+  StageCounter mFinalizeCounter;
+  FrameResampler mResampler;
+  Watermark mWatermark;
+  VideoFrame mLastFrame;
+  VideoFrame mBlankFrame;
 };
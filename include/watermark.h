@@ -0,0 +1,40 @@
+#pragma once
+
+#include "globals.h"
+
+enum class WatermarkPosition { TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT };
+
+struct WatermarkParams {
+  std::string name;
+  std::string textTemplate{"%F %T {name}"}; // strftime format, {name} = name
+  WatermarkPosition position{WatermarkPosition::TOP_LEFT};
+  double scale{1.5};
+  bool useLocaltime{true};
+};
+
+// Renders the label into a small premultiplied color patch and alpha mask
+// once per second, then blends that patch into every frame of the second.
+class Watermark {
+public:
+  Watermark();
+
+  ~Watermark();
+
+  bool init(const WatermarkParams &params, const cv::Size &frameSize);
+
+  void apply(cv::Mat &frame, const time_t t);
+
+  static WatermarkPosition parsePosition(const std::string &position);
+
+private:
+  void render(const time_t t);
+
+  std::string formatLabel(const time_t t) const;
+
+  WatermarkParams mParams;
+  cv::Size mFrameSize;
+  time_t mRenderedTime = -1;
+  cv::Rect mRoi;
+  cv::Mat mLabel;    // premultiplied label colors, CV_8UC3
+  cv::Mat mInvAlpha; // 255 - alpha, expanded to 3 channels
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "task.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process-wide work-stealing scheduler. Every worker owns a task deque, runs
+// its own tasks newest-first and steals the oldest tasks of the others when
+// its deque runs dry.
+class WorkerPool {
+public:
+  WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  ~WorkerPool();
+
+  bool init(uint32_t threadCount = 0);
+
+  void submit(Task &&task);
+
+  void stop();
+
+  uint32_t threadCount() const;
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  void workerLoop(uint32_t index);
+
+  bool popTask(uint32_t index, Task &task);
+
+  bool stealTask(uint32_t index, Task &task);
+
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+  std::mutex mWakeMutex;
+  std::condition_variable mWakeCondition;
+  std::atomic<uint32_t> mPendingTasks = 0;
+  std::atomic<uint32_t> mNextWorker = 0;
+  std::atomic_bool mExitFlag = false;
+};
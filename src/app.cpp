@@ -4,9 +4,12 @@
 #include "file_manager.h"
 #include "file_system.h"
 #include "globals.h"
+#include "metrics_renderer.h"
 #include <csignal>
 
 std::atomic_bool App::sExitFlag = false;
+std::mutex App::sExitMutex;
+std::condition_variable App::sExitCondition;
 
 App::App() {
   signal(SIGINT, signalHandler);
@@ -14,7 +17,13 @@ App::App() {
   signal(SIGKILL, signalHandler);
 }
 
-App::~App() {}
+App::~App() {
+  // scrapes read the capturers, capturers hand their tasks to the pool
+  mMetricsServer.stop();
+  mCapturers.clear();
+  mMjpegHttpLoop.stop();
+  mWorkerPool.stop();
+}
 
 ExitCode App::exec(int argc, char *argv[]) {
   google::InitGoogleLogging(argv[0]);
@@ -46,16 +55,30 @@ ExitCode App::exec(int argc, char *argv[]) {
     return c;
   }
 
+  // init worker-pool
+  if (ExitCode c = initWorkerPool()) {
+    return c;
+  }
+
   // init capturers
   if (ExitCode c = initCapturers()) {
     return c;
   }
 
+  // init metrics endpoint
+  if (ExitCode c = initMetrics()) {
+    return c;
+  }
+
   LOG(INFO) << "househub is started.";
 
-  // main loop
-  while (!sExitFlag) {
-    std::this_thread::yield();
+  // main loop, sleeps until exit() is called. signal handlers can not notify
+  // a condition variable safely, so the flag is also polled once a second
+  {
+    std::unique_lock<std::mutex> lock(sExitMutex);
+    while (!sExitFlag) {
+      sExitCondition.wait_for(lock, std::chrono::seconds(1));
+    }
   }
 
   LOG(INFO) << "househub is stopped.";
@@ -63,7 +86,13 @@ ExitCode App::exec(int argc, char *argv[]) {
   return ExitCode::NORMAL;
 }
 
-void App::exit() { sExitFlag = true; }
+void App::exit() {
+  {
+    std::lock_guard<std::mutex> lock(sExitMutex);
+    sExitFlag = true;
+  }
+  sExitCondition.notify_all();
+}
 
 ExitCode App::initConfigManager(const std::string &iniFile) {
   auto &cm = ConfigManager::instance();
@@ -111,10 +140,22 @@ ExitCode App::initFileManager() {
       cm.getString("file_manager", "record_dir", "./househub-records/");
   fmp.recordDirSizeLimitMB =
       cm.getInt("file_manager", "record_dir_size_limit_mb", 8192);
-  fmp.recordDirSizeCheckIntervalSec =
-      cm.getInt("file_manager", "record_dir_size_check_interval_sec", 10);
   fmp.useLocalTime = cm.getBool("file_manager", "use_localtime", false);
 
+  // retention policies live in the capturer sections
+  const auto &capturers = split(cm.getString("app_settings", "capturers"), '|');
+  for (const auto &capN : capturers) {
+    if (cm.hasSection(capN)) {
+      RetentionPolicy rp;
+      rp.maxBytes =
+          static_cast<uint64_t>(cm.getInt(capN, "retention_max_mb", 0)) *
+          1048576;
+      rp.maxAgeSec = cm.getInt(capN, "retention_max_days", 0) * 86400;
+      rp.minKeepSec = cm.getInt(capN, "retention_min_days", 0) * 86400;
+      fmp.retentionPolicies[cm.getString(capN, "name", capN)] = rp;
+    }
+  }
+
   auto &fm = FileManager::instance();
   if (!fm.init(fmp)) {
     LOG(FATAL) << "file directory r/w error: " << fmp.recordDir;
@@ -124,9 +165,27 @@ ExitCode App::initFileManager() {
   return ExitCode::NORMAL;
 }
 
+ExitCode App::initWorkerPool() {
+  auto &cm = ConfigManager::instance();
+
+  // 0 means one worker per core
+  const long workerThreads = cm.getInt("app_settings", "worker_threads", 0);
+  if (!mWorkerPool.init(std::max(0L, workerThreads))) {
+    LOG(FATAL) << "worker pool could not started.";
+    return ExitCode::BAD_WORKER_POOL;
+  }
+
+  return ExitCode::NORMAL;
+}
+
 ExitCode App::initCapturers() {
   auto &cm = ConfigManager::instance();
 
+  // the streams shed frames before their queued writes exceed this together
+  mMemoryBudget.init(
+      static_cast<uint64_t>(cm.getInt("app_settings", "memory_budget_mb", 0)) *
+      1048576);
+
   const auto &capturers = split(cm.getString("app_settings", "capturers"), '|');
   for (const auto &capN : capturers) {
     if (cm.hasSection(capN)) {
@@ -135,9 +194,26 @@ ExitCode App::initCapturers() {
       cp.type = cm.getString(capN, "type", "default");
       cp.filterK = cm.getInt(capN, "filter_k", 0);
       cp.flipX = cm.getBool(capN, "flip_x", false);
-      cp.flipX = cm.getBool(capN, "flip_y", false);
+      cp.flipY = cm.getBool(capN, "flip_y", false);
+      cp.preprocessThreads = cm.getInt(capN, "preprocess_threads", 1);
+      cp.mjpegPassthrough = cm.getBool(capN, "mjpeg_passthrough", true);
+      cp.mjpegHttpInput = cm.getBool(capN, "mjpeg_http_input", true);
       cp.streamUri =
           cm.getString(capN, "stream_uri", "http://localhost/stream");
+      cp.stallTimeoutSec = cm.getInt(capN, "stall_timeout_sec", 2);
+      cp.connectTimeoutMs = cm.getInt(capN, "connect_timeout_ms", 5000);
+      cp.reconnectMinMs = cm.getInt(capN, "reconnect_min_ms", 500);
+      cp.reconnectMaxMs = cm.getInt(capN, "reconnect_max_ms", 30000);
+      cp.syntheticParams.frameSize =
+          cv::Size(cm.getInt(capN, "synthetic_width", 1280),
+                   cm.getInt(capN, "synthetic_height", 720));
+      cp.syntheticParams.fps = cm.getInt(capN, "synthetic_fps", 10);
+      cp.syntheticParams.file = cm.getString(capN, "synthetic_file", "");
+      cp.ringCapacity = cm.getInt(capN, "ring_capacity", 8);
+      cp.ringOverflowPolicy =
+          cm.getString(capN, "ring_overflow", "drop_oldest") == "drop_newest"
+              ? OverflowPolicy::DROP_NEWEST
+              : OverflowPolicy::DROP_OLDEST;
       cp.videoOutStreamParams.name = cp.name;
 
       cp.videoOutStreamParams.fps = cm.getInt(capN, "output_fps", 10);
@@ -155,8 +231,67 @@ ExitCode App::initCapturers() {
       cp.videoOutStreamParams.fileExtension =
           cm.getString(capN, "file_extension", ".avi");
 
+      cp.videoOutStreamParams.writeBufferBytes =
+          cm.getInt(capN, "write_buffer_kb", 1024) * 1024;
+
+      cp.videoOutStreamParams.syncIntervalSec =
+          cm.getInt(capN, "sync_interval_sec", 5);
+
+      cp.videoOutStreamParams.preallocate =
+          cm.getBool(capN, "preallocate", true);
+
+      cp.videoOutStreamParams.fragmentSec = cm.getInt(capN, "fragment_sec", 0);
+
+      cp.videoOutStreamParams.recordMode = VideoOutStream::parseRecordMode(
+          cm.getString(capN, "record_mode", "continuous"));
+
+      cp.videoOutStreamParams.preEventSec = cm.getInt(capN, "pre_event_sec", 5);
+
+      cp.videoOutStreamParams.preEventBytes =
+          static_cast<uint64_t>(cm.getInt(capN, "pre_event_kb", 8192)) * 1024;
+
+      cp.videoOutStreamParams.postEventSec =
+          cm.getInt(capN, "post_event_sec", 10);
+
+      cp.videoOutStreamParams.idleFps = cm.getInt(capN, "idle_fps", 1);
+
+      cp.videoOutStreamParams.adaptiveFps =
+          cm.getBool(capN, "adaptive_fps", false);
+
+      cp.videoOutStreamParams.adaptiveMinFps =
+          cm.getInt(capN, "adaptive_min_fps", 1);
+
+      cp.videoOutStreamParams.queueBudgetBytes =
+          static_cast<uint64_t>(cm.getInt(capN, "queue_budget_kb", 32768)) *
+          1024;
+
+      cp.videoOutStreamParams.memoryBudget = &mMemoryBudget;
+
+      cp.videoOutStreamParams.shedPolicy = VideoOutStream::parseShedPolicy(
+          cm.getString(capN, "shed_policy", "drop_frames"));
+
+      cp.motionDetectorParams.scale = cm.getInt(capN, "motion_scale", 8);
+      cp.motionDetectorParams.pixelThreshold =
+          cm.getInt(capN, "motion_pixel_threshold", 25);
+      cp.motionDetectorParams.areaThreshold =
+          cm.getDouble(capN, "motion_area_threshold", 0.01);
+      cp.motionDetectorParams.learningRate =
+          cm.getDouble(capN, "motion_learning_rate", 0.05);
+      cp.motionDetectorParams.stillThreshold =
+          cm.getDouble(capN, "still_threshold", 0.002);
+
       cp.videoOutStreamParams.watermark = cm.getBool(capN, "watermark", true);
 
+      cp.videoOutStreamParams.watermarkParams.textTemplate = cm.getString(
+          capN, "watermark_template", "%F %T {name}");
+
+      cp.videoOutStreamParams.watermarkParams.position =
+          Watermark::parsePosition(
+              cm.getString(capN, "watermark_position", "top_left"));
+
+      cp.videoOutStreamParams.watermarkParams.scale =
+          cm.getDouble(capN, "watermark_scale", 1.5);
+
       cp.videoOutStreamParams.useLocaltime =
           cm.getBool(capN, "use_localtime", true);
 
@@ -168,7 +303,8 @@ ExitCode App::initCapturers() {
       std::copy(fourcc.c_str(), fourcc.c_str() + 4,
                 cp.videoOutStreamParams.fourcc);
 
-      auto cap = CapturerFactory::createCapturer(cp);
+      auto cap =
+          CapturerFactory::createCapturer(cp, mWorkerPool, mMjpegHttpLoop);
       if (!cap) {
         LOG(FATAL) << "bad capturer type: " << cp.type;
         return ExitCode::BAD_CAPTURER_TYPE;
@@ -198,8 +334,37 @@ ExitCode App::initCapturers() {
   return ExitCode::NORMAL;
 }
 
+ExitCode App::initMetrics() {
+  auto &cm = ConfigManager::instance();
+
+  // 0 disables the endpoint
+  const long port = cm.getInt("app_settings", "metrics_port", 0);
+  if (port <= 0 || port > 65535) {
+    return ExitCode::NORMAL;
+  }
+
+  const std::string address =
+      cm.getString("app_settings", "metrics_address", "127.0.0.1");
+  auto renderer = [this]() {
+    std::vector<CapturerMetrics> capturers;
+    for (auto &cap : mCapturers) {
+      capturers.push_back({cap->params().name, cap->stats()});
+    }
+    return MetricsRenderer::render(capturers, FileManager::instance().stats(),
+                                   mMemoryBudget.stats());
+  };
+
+  // recording goes on without the endpoint
+  if (!mMetricsServer.init(address, static_cast<uint16_t>(port),
+                           std::move(renderer))) {
+    LOG(ERROR) << "metrics endpoint could not be started.";
+  }
+
+  return ExitCode::NORMAL;
+}
+
 void App::signalHandler(int signum) {
   LOG(INFO) << "!! Signal " << signum << " received. Terminating... !!";
 
-  exit();
+  sExitFlag = true;
 }
\ No newline at end of file
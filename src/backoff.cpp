@@ -0,0 +1,24 @@
+#include "backoff.h"
+#include <algorithm>
+
+Backoff::Backoff() : mRandom(std::random_device()()) {}
+
+void Backoff::init(uint32_t minMs, uint32_t maxMs) {
+  mMinMs = minMs;
+  mMaxMs = std::max(maxMs, 1u);
+  mAttempts = 0;
+}
+
+uint64_t Backoff::nextDelayMs() {
+  const uint32_t shift = std::min<uint32_t>(mAttempts, 16);
+  const uint64_t delayMs = std::min<uint64_t>(
+      mMaxMs, static_cast<uint64_t>(mMinMs) << shift);
+  mAttempts++;
+
+  std::uniform_int_distribution<uint64_t> jitter(delayMs / 2, delayMs);
+  return jitter(mRandom);
+}
+
+void Backoff::reset() { mAttempts = 0; }
+
+uint32_t Backoff::attempts() const { return mAttempts; }
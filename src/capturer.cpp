@@ -1,91 +1,518 @@
 #include "capturer.h"
+#include <algorithm>
 
-Capturer::Capturer() {}
+Capturer::Capturer(WorkerPool &workerPool, MjpegHttpLoop *httpLoop)
+    : mWorkerPool(workerPool), mHttpLoop(httpLoop) {}
 
 Capturer::~Capturer() {
   mExitFlag = true;
-  if (mCaptureThread.joinable()) {
-    mCaptureThread.join();
+  wakeUp();
+  if (mGrabThread.joinable()) {
+    mGrabThread.join();
   }
+  if (mHttpLoop) {
+    mHttpLoop->remove(this);
+  }
+
+  // wait for the in-flight processing task
+  std::unique_lock<std::mutex> lock(mProcessMutex);
+  mProcessCondition.wait(lock, [this]() { return !mProcessScheduled; });
 }
 
 bool Capturer::init(const CapturerParams &params) {
   mParams = params;
+  const bool httpInput = mParams.type != "synthetic" &&
+                         mParams.streamUri.compare(0, 7, "http://") == 0;
+
+  // mjpeg in-stream payloads can go to an mjpeg out-stream as they are when
+  // the frames are not touched at all
+  std::string fourcc(mParams.videoOutStreamParams.fourcc, 4);
+  std::transform(fourcc.begin(), fourcc.end(), fourcc.begin(), ::tolower);
+  mPassthrough = mParams.mjpegPassthrough && fourcc == "mjpg" &&
+                 mParams.filterK <= 1 && !mParams.flipX && !mParams.flipY &&
+                 !mParams.videoOutStreamParams.watermark && httpInput;
+  mParams.videoOutStreamParams.passthrough = mPassthrough;
+  if (mPassthrough) {
+    LOG(INFO) << "capturer records mjpeg passthrough: " << mParams.name;
+  }
+
+  // http mjpeg in-streams are read natively and decoded here, so the decode
+  // can be scaled down to the output geometry
+  mMjpegHttpInput = mPassthrough || (mParams.mjpegHttpInput && httpInput);
+  if (mHttpLoop && !httpInput) {
+    LOG(ERROR) << "capturer in-stream is not http: " << mParams.name;
+    return false;
+  }
+
+  // re-encoding shares the pool with the processing
+  mParams.videoOutStreamParams.workerPool = &mWorkerPool;
   mOutStream.reset(new VideoOutStream());
 
   if (!mOutStream->init(mParams.videoOutStreamParams)) {
     return false;
   }
 
-  mCaptureThread = std::thread([this]() {
-    mVideoCapture.reset(new cv::VideoCapture(mParams.streamUri));
+  PreprocessorParams pp;
+  pp.outputSize = mParams.videoOutStreamParams.outputSize;
+  pp.filterK = mParams.filterK;
+  pp.flipX = mParams.flipX;
+  pp.flipY = mParams.flipY;
+  pp.threads = mParams.preprocessThreads;
+  if (!mPreprocessor.init(pp)) {
+    return false;
+  }
+
+  // motion drives the recording in the motion modes, still frames the
+  // adaptive frame rate
+  const RecordMode recordMode = mParams.videoOutStreamParams.recordMode;
+  mMotionDetection = recordMode == RecordMode::MOTION ||
+                     recordMode == RecordMode::MOTION_FPS;
+  mStillDetection = mParams.videoOutStreamParams.adaptiveFps;
+  if ((mMotionDetection || mStillDetection) &&
+      !mMotionDetector.init(mParams.motionDetectorParams)) {
+    return false;
+  }
+
+  if (!mFrameRing.init(mParams.ringCapacity, mParams.ringOverflowPolicy)) {
+    return false;
+  }
+
+  // the loop thread takes the grab stage of all its capturers
+  if (mHttpLoop) {
+    MjpegHttpSourceParams sp;
+    sp.name = mParams.name;
+    sp.uri = mParams.streamUri;
+    sp.connectTimeoutMs = mParams.connectTimeoutMs;
+    sp.stallTimeoutSec = mParams.stallTimeoutSec;
+    sp.reconnectMinMs = mParams.reconnectMinMs;
+    sp.reconnectMaxMs = mParams.reconnectMaxMs;
+    return mHttpLoop->add(this, sp);
+  }
+
+  mBackoff.init(mParams.reconnectMinMs, mParams.reconnectMaxMs);
+
+  // the grab stage only talks to the in-stream, the process stage runs as
+  // tasks on the shared worker pool, so a slow encoder or a chunk rollover
+  // never stalls grabbing
+  mGrabThread = std::thread([this]() { grabLoop(); });
+
+  return true;
+}
+
+void Capturer::startCapture() {
+  mCapturing = true;
+  wakeUp();
+  LOG(INFO) << "capturer started: " << mParams.name;
+}
+
+void Capturer::stopCapture() {
+  mCapturing = false;
+  LOG(INFO) << "capturer stopped: " << mParams.name;
+}
+
+bool Capturer::isCapturing() const { return mCapturing; }
+
+bool Capturer::isStreamHealthy() const { return mStreamHealthy; }
+
+void Capturer::triggerEvent() { mOutStream->triggerEvent(std::time(nullptr)); }
+
+CapturerStats Capturer::stats() const {
+  CapturerStats s;
+  s.grab = mGrabCounter.snapshot();
+  s.decode = mDecodeCounter.snapshot();
+  s.preprocess = mPreprocessCounter.snapshot();
+  s.motion = mMotionCounter.snapshot();
+  s.process = mProcessCounter.snapshot();
+  s.ring = mFrameRing.stats();
+  s.ringDepth = mFrameRing.size();
+  s.out = mOutStream->stats();
+  s.streamHealthy = mStreamHealthy;
+  s.motionScore = mMotionScore.load(std::memory_order_relaxed);
+  s.motionFrames = mMotionFrames.load(std::memory_order_relaxed);
+  return s;
+}
+
+CapturerParams &Capturer::params() { return mParams; }
+
+int Capturer::reducedDecodeFlag(const cv::Size &srcSize,
+                                const cv::Size &outputSize) {
+  // the largest 1/2, 1/4, 1/8 scale that still covers the output size
+  static const std::pair<int, int> scales[] = {
+      {8, cv::IMREAD_REDUCED_COLOR_8},
+      {4, cv::IMREAD_REDUCED_COLOR_4},
+      {2, cv::IMREAD_REDUCED_COLOR_2}};
+  for (const auto &s : scales) {
+    const int w = (srcSize.width + s.first - 1) / s.first;
+    const int h = (srcSize.height + s.first - 1) / s.first;
+    if (w >= outputSize.width && h >= outputSize.height) {
+      return s.second;
+    }
+  }
+
+  return cv::IMREAD_COLOR;
+}
 
-    while (!mExitFlag) {
+void Capturer::grabLoop() {
+  startConnect();
 
-      const time_t t = std::time(nullptr);
+  while (!mExitFlag) {
 
-      // try grab & retrieve a frame
-      if (mCapturing && mVideoCapture->isOpened() && mVideoCapture->grab() &&
-          mVideoCapture->retrieve(mLastGrabedFrame)) {
-        mLastGrabTime = t;
+    const time_t t = std::time(nullptr);
 
-        // resize
-        cv::resize(mLastGrabedFrame, mLastGrabedFrame,
-                   mParams.videoOutStreamParams.outputSize);
+    // keep the out-stream ticking while no frame arrives
+    if (t != mLastScheduleTime) {
+      scheduleProcessing();
+    }
 
-        // filter the frame
-        if (mParams.filterK > 1) {
-          cv::medianBlur(mLastGrabedFrame, mLastGrabedFrame,
-                         mParams.filterK % 2 ? mParams.filterK
-                                             : mParams.filterK + 1);
-        }
+    // take over the in-stream once the attempt is done
+    if (mInStreamState == InStreamState::CONNECTING && mConnectDone) {
+      finishConnect();
+    }
 
-        // flip the frame
-        if (mParams.flipX || mParams.flipY) {
-          const bool fxy = mParams.flipX && mParams.flipY;
-          cv::flip(mLastGrabedFrame, mLastGrabedFrame,
-                   fxy ? -1 : (mParams.flipY ? 1 : 0));
-        }
+    // sleep until the capturing is started again
+    if (!mCapturing) {
+      waitForWakeUp(std::chrono::seconds(1));
+      continue;
+    }
 
-        // feed the out-stream
-        mOutStream->feed(std::move(mLastGrabedFrame), t);
+    // connection attempts run aside, so they never hold up the ticks
+    if (mInStreamState == InStreamState::CONNECTING) {
+      waitForWakeUp(std::chrono::seconds(1));
+      continue;
+    }
 
-        if (!mStreamHealthy) {
-          mStreamHealthy = true;
-          LOG(INFO) << "capturer in-stream is up: " << mParams.name;
-        }
+    if (mInStreamState == InStreamState::BACKOFF) {
+      const uint64_t now = steadyTimeNs();
+      if (now >= mNextConnectNs) {
+        startConnect();
+      } else {
+        waitForWakeUp(std::chrono::milliseconds(
+            std::min<uint64_t>(1000, (mNextConnectNs - now) / 1000000 + 1)));
       }
+      continue;
+    }
 
-      // update the out-stream
-      mOutStream->update(t);
+    if (grabFrame(t)) {
+      if (!mStreamHealthy) {
+        mStreamHealthy = true;
+        mBackoff.reset();
+        LOG(INFO) << "capturer in-stream is up: " << mParams.name;
+      }
 
-      // stream health check
-      if (t - mLastGrabTime > 1) {
-        mVideoCapture.reset(new cv::VideoCapture(mParams.streamUri));
+      continue;
+    }
 
-        if (mStreamHealthy) {
-          mStreamHealthy = false;
-          LOG(WARNING) << "capturer in-stream is down: " << mParams.name;
-        }
+    // stream health check
+    const uint64_t stallNs = mParams.stallTimeoutSec * 1000000000ULL;
+    if (steadyTimeNs() - mLastGrabNs > stallNs) {
+      if (mStreamHealthy) {
+        mStreamHealthy = false;
+        LOG(WARNING) << "capturer in-stream is down: " << mParams.name;
       }
+
+      mMjpegStream.reset();
+      mVideoCapture.reset();
+      mSynthetic.reset();
+      scheduleReconnect();
+    } else {
+      waitForWakeUp(std::chrono::milliseconds(100));
     }
+  }
+
+  if (mConnectThread.joinable()) {
+    mConnectThread.join();
+  }
+}
+
+void Capturer::startConnect() {
+  mInStreamState = InStreamState::CONNECTING;
+  mConnectDone = false;
+  mConnectThread = std::thread([this]() {
+    connectInStream();
+    mConnectDone = true;
+    wakeUp();
   });
+}
+
+void Capturer::connectInStream() {
+  const int stallMs = mParams.stallTimeoutSec * 1000;
+
+  if (mParams.type == "synthetic") {
+    mPendingSynthetic.reset(new SyntheticSource());
+    mPendingSynthetic->open(mParams.syntheticParams);
+    return;
+  }
+
+  if (mMjpegHttpInput) {
+    mPendingMjpegStream.reset(new MjpegHttpStream());
+    if (mPendingMjpegStream->open(mParams.streamUri,
+                                  mParams.connectTimeoutMs)) {
+      mPendingMjpegStream->setReadTimeout(stallMs);
+      return;
+    }
+
+    if (!mPendingMjpegStream->isUnsupported()) {
+      return;
+    }
+
+    // not a multipart stream, frames are decoded by the capture backend (and
+    // re-encoded by the out-stream when passing through) from now on
+    LOG(WARNING) << "capturer in-stream is not mjpeg, native input disabled: "
+                 << mParams.name;
+    mPendingMjpegStream.reset();
+    mMjpegHttpInput = false;
+  }
+
+  // bounded, a dead camera must not block the attempt for long
+  mPendingVideoCapture.reset(new cv::VideoCapture(
+      mParams.streamUri, cv::CAP_ANY,
+      {cv::CAP_PROP_OPEN_TIMEOUT_MSEC,
+       static_cast<int>(mParams.connectTimeoutMs),
+       cv::CAP_PROP_READ_TIMEOUT_MSEC, stallMs}));
+}
+
+void Capturer::finishConnect() {
+  mConnectThread.join();
+  mMjpegStream = std::move(mPendingMjpegStream);
+  mVideoCapture = std::move(mPendingVideoCapture);
+  mSynthetic = std::move(mPendingSynthetic);
+
+  const bool opened = mMjpegStream  ? mMjpegStream->isOpened()
+                      : mSynthetic ? mSynthetic->isOpened()
+                                   : mVideoCapture && mVideoCapture->isOpened();
+  if (!opened) {
+    mMjpegStream.reset();
+    mVideoCapture.reset();
+    mSynthetic.reset();
+    scheduleReconnect();
+    return;
+  }
+
+  // the stall timeout runs from here until the first frame
+  mInStreamState = InStreamState::OPEN;
+  mLastGrabNs = steadyTimeNs();
+}
+
+void Capturer::scheduleReconnect() {
+  const uint64_t waitMs = mBackoff.nextDelayMs();
+  mNextConnectNs = steadyTimeNs() + waitMs * 1000000;
+  mInStreamState = InStreamState::BACKOFF;
+
+  if (mBackoff.attempts() == 1 || waitMs >= 10000) {
+    LOG(INFO) << "capturer in-stream reconnect in " << waitMs
+              << " ms: " << mParams.name;
+  }
+}
+
+bool Capturer::grabFrame(const time_t t) {
+  // generated frames, paced outside of the measured grab
+  if (mSynthetic) {
+    mSynthetic->wait();
+    const uint64_t grabStartNs = steadyTimeNs();
+    mLastGrabNs = grabStartNs;
+
+    RingFrame *rf = mFrameRing.acquireWrite();
+    if (rf && mSynthetic->read(rf->frame)) {
+      rf->jpeg.clear();
+      rf->time = t;
+      rf->timeNs = grabStartNs;
+      mFrameRing.commitWrite();
+      mGrabCounter.add(steadyTimeNs() - grabStartNs);
+      scheduleProcessing();
+    }
+
+    return true;
+  }
+
+  const uint64_t grabStartNs = steadyTimeNs();
+
+  // compressed payloads straight from the http stream
+  if (mMjpegStream) {
+    if (!mMjpegStream->isOpened()) {
+      return false;
+    }
+
+    // the slot is only taken once the payload is in, so no queued frame is
+    // dropped for the blocking read
+    if (!mMjpegStream->read(mGrabJpeg)) {
+      return false;
+    }
+    mLastGrabNs = steadyTimeNs();
+
+    if (RingFrame *rf = mFrameRing.acquireWrite()) {
+      // the slot's buffer is the next read's
+      rf->jpeg.swap(mGrabJpeg);
+      rf->time = t;
+      rf->timeNs = steadyTimeNs();
+      mFrameRing.commitWrite();
+      mGrabCounter.add(rf->timeNs - grabStartNs);
+      scheduleProcessing();
+    }
+
+    return true;
+  }
+
+  // try grab a frame, it is retrieved only when the ring has room for it
+  if (!mVideoCapture->isOpened() || !mVideoCapture->grab()) {
+    return false;
+  }
+
+  // monotonic capture time, taken right after the grab
+  const uint64_t grabNs = steadyTimeNs();
+  mLastGrabNs = grabNs;
+
+  if (RingFrame *rf = mFrameRing.acquireWrite()) {
+    if (mVideoCapture->retrieve(rf->frame)) {
+      rf->jpeg.clear();
+      rf->time = t;
+      rf->timeNs = grabNs;
+      mFrameRing.commitWrite();
+      mGrabCounter.add(steadyTimeNs() - grabStartNs);
+      scheduleProcessing();
+    }
+  }
 
   return true;
 }
 
-void Capturer::startCapture() {
-  mCapturing = true;
-  LOG(INFO) << "capturer started: " << mParams.name;
+bool Capturer::waitForWakeUp(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mGrabMutex);
+  mGrabCondition.wait_for(lock, timeout,
+                          [this]() { return mWakeUpFlag || mExitFlag; });
+  mWakeUpFlag = false;
+  return !mExitFlag;
 }
 
-void Capturer::stopCapture() {
-  mCapturing = false;
-  LOG(INFO) << "capturer stopped: " << mParams.name;
+void Capturer::wakeUp() {
+  {
+    std::lock_guard<std::mutex> lock(mGrabMutex);
+    mWakeUpFlag = true;
+  }
+  mGrabCondition.notify_all();
 }
 
-bool Capturer::isCapturing() const { return mCapturing; }
+std::vector<uchar> *Capturer::acquireJpeg() {
+  mLoopFrame = mCapturing ? mFrameRing.acquireWrite() : nullptr;
+  return mLoopFrame ? &mLoopFrame->jpeg : nullptr;
+}
 
-bool Capturer::isStreamHealthy() const { return mStreamHealthy; }
+void Capturer::commitJpeg(uint64_t busyNs) {
+  mLoopFrame->time = std::time(nullptr);
+  mLoopFrame->timeNs = steadyTimeNs();
+  mLoopFrame = nullptr;
+  mFrameRing.commitWrite();
+  mGrabCounter.add(busyNs);
+  scheduleProcessing();
+}
 
-CapturerParams &Capturer::params() { return mParams; }
+void Capturer::tick() {
+  if (std::time(nullptr) != mLastScheduleTime) {
+    scheduleProcessing();
+  }
+}
+
+void Capturer::streamChanged(bool healthy) {
+  mStreamHealthy = healthy;
+  if (healthy) {
+    LOG(INFO) << "capturer in-stream is up: " << mParams.name;
+  } else {
+    LOG(WARNING) << "capturer in-stream is down: " << mParams.name;
+  }
+}
+
+void Capturer::scheduleProcessing() {
+  {
+    std::lock_guard<std::mutex> lock(mProcessMutex);
+    mLastScheduleTime = std::time(nullptr);
+    if (mProcessScheduled) {
+      return;
+    }
+    mProcessScheduled = true;
+  }
+
+  // only one task per capturer is in flight, so the ring keeps a single
+  // consumer even though tasks may run on different workers
+  mWorkerPool.submit([this]() { processTask(); });
+}
+
+void Capturer::processTask() {
+  while (true) {
+    // drain the ring
+    while (RingFrame *rf = mFrameRing.acquireRead()) {
+      processFrame(*rf);
+      mFrameRing.releaseRead();
+    }
+
+    // update the out-stream
+    mOutStream->update(steadyTimeNs());
+
+    // frames committed during the update are taken by this task as well
+    std::lock_guard<std::mutex> lock(mProcessMutex);
+    if (mExitFlag || mFrameRing.size() == 0) {
+      mProcessScheduled = false;
+      mProcessCondition.notify_all();
+      return;
+    }
+  }
+}
+
+void Capturer::processFrame(RingFrame &rf) {
+  const uint64_t processStartNs = steadyTimeNs();
+
+  // jpeg payloads are recorded as they are if passing through and they
+  // already have the output geometry, decoded otherwise
+  if (!rf.jpeg.empty()) {
+    const cv::Size &outputSize = mParams.videoOutStreamParams.outputSize;
+    cv::Size size;
+    const bool sized = MjpegHttpStream::jpegSize(rf.jpeg, size);
+    if (mPassthrough && sized && size == outputSize) {
+      bool still = false;
+      if (mMotionDetection || mStillDetection) {
+        still = detectMotion(mMotionDetector.updateEncoded(rf.jpeg), rf.time);
+      }
+
+      mOutStream->feedEncoded(
+          std::make_shared<const std::vector<uchar>>(rf.jpeg), rf.time,
+          rf.timeNs, still);
+      mProcessCounter.add(steadyTimeNs() - processStartNs);
+      return;
+    }
+
+    // scaled dct decode, only the remainder is resized
+    cv::imdecode(rf.jpeg,
+                 sized ? reducedDecodeFlag(size, outputSize) : cv::IMREAD_COLOR,
+                 &rf.frame);
+    mDecodeCounter.add(steadyTimeNs() - processStartNs);
+  }
+
+  // resize, filter and flip in one pass into a pooled buffer (the slot
+  // buffer stays in the ring for the next grab, the pooled one goes back to
+  // the pool once encoded)
+  const uint64_t preprocessStartNs = steadyTimeNs();
+  cv::Mat frame = mOutStream->acquireFrame();
+  mPreprocessor.process(rf.frame, frame);
+  const uint64_t preprocessEndNs = steadyTimeNs();
+  mPreprocessCounter.add(preprocessEndNs - preprocessStartNs);
+
+  // before the watermark, its label changes every second
+  bool still = false;
+  if (mMotionDetection || mStillDetection) {
+    still = detectMotion(mMotionDetector.update(frame), rf.time);
+    mMotionCounter.add(steadyTimeNs() - preprocessEndNs);
+  }
+
+  // feed the out-stream
+  mOutStream->feed(std::move(frame), rf.time, rf.timeNs, still);
+
+  mProcessCounter.add(steadyTimeNs() - processStartNs);
+}
+
+bool Capturer::detectMotion(double score, const time_t t) {
+  mMotionScore.store(score, std::memory_order_relaxed);
+  if (mMotionDetection && mMotionDetector.isMotion(score)) {
+    mMotionFrames.fetch_add(1, std::memory_order_relaxed);
+    mOutStream->triggerEvent(t);
+  }
+
+  return mStillDetection && mMotionDetector.isStill();
+}
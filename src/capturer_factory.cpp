@@ -3,10 +3,18 @@
 #include <algorithm>
 
 std::unique_ptr<ICapturer>
-CapturerFactory::createCapturer(const CapturerParams &params) {
+CapturerFactory::createCapturer(const CapturerParams &params,
+                                WorkerPool &workerPool,
+                                MjpegHttpLoop &httpLoop) {
 
-  if (params.type == "default") {
-    return std::unique_ptr<ICapturer>(new Capturer());
+  // synthetic frames for benchmarks, grabbed like a camera
+  if (params.type == "default" || params.type == "synthetic") {
+    return std::unique_ptr<ICapturer>(new Capturer(workerPool));
+  }
+
+  // mjpeg over http, all of them read by one event loop
+  if (params.type == "mjpeg_http") {
+    return std::unique_ptr<ICapturer>(new Capturer(workerPool, &httpLoop));
   }
 
   return nullptr;
@@ -0,0 +1,119 @@
+#include "chunk_catalog.h"
+
+ChunkCatalog::ChunkCatalog() {}
+
+ChunkCatalog::~ChunkCatalog() {}
+
+void ChunkCatalog::add(const ChunkRef &ref) {
+  remove(ref.path);
+
+  const Key key(ref.startTime, ref.path);
+  mChunks.emplace(key, ref);
+  mStartTimes.emplace(ref.path, ref.startTime);
+
+  CapturerIndex &index = mCapturers[ref.capturerName];
+  index.keys.insert(key);
+  index.bytes += ref.sizeBytes;
+
+  if (ref.active) {
+    mActivePaths.insert(ref.path);
+  } else {
+    index.inactiveKeys.insert(key);
+    mInactiveKeys.insert(key);
+  }
+  mTotalBytes += ref.sizeBytes;
+}
+
+bool ChunkCatalog::remove(const std::string &path) {
+  auto it = mStartTimes.find(path);
+  if (it == mStartTimes.end()) {
+    return false;
+  }
+
+  const Key key(it->second, path);
+  auto chunkIt = mChunks.find(key);
+  mTotalBytes -= chunkIt->second.sizeBytes;
+
+  auto indexIt = mCapturers.find(chunkIt->second.capturerName);
+  indexIt->second.keys.erase(key);
+  indexIt->second.inactiveKeys.erase(key);
+  indexIt->second.bytes -= chunkIt->second.sizeBytes;
+  if (indexIt->second.keys.empty()) {
+    mCapturers.erase(indexIt);
+  }
+
+  mChunks.erase(chunkIt);
+  mInactiveKeys.erase(key);
+  mStartTimes.erase(it);
+  mActivePaths.erase(path);
+
+  return true;
+}
+
+bool ChunkCatalog::setSize(const std::string &path, uint64_t sizeBytes) {
+  auto it = mStartTimes.find(path);
+  if (it == mStartTimes.end()) {
+    return false;
+  }
+
+  ChunkRef &ref = mChunks.find(Key(it->second, path))->second;
+  mTotalBytes = mTotalBytes - ref.sizeBytes + sizeBytes;
+
+  CapturerIndex &index = mCapturers[ref.capturerName];
+  index.bytes = index.bytes - ref.sizeBytes + sizeBytes;
+
+  ref.sizeBytes = sizeBytes;
+
+  return true;
+}
+
+const ChunkRef *ChunkCatalog::find(const std::string &path) const {
+  auto it = mStartTimes.find(path);
+  return it == mStartTimes.end() ? nullptr
+                                 : &mChunks.find(Key(it->second, path))->second;
+}
+
+const ChunkRef *ChunkCatalog::oldest() const {
+  return mInactiveKeys.empty() ? nullptr
+                               : &mChunks.find(*mInactiveKeys.begin())->second;
+}
+
+const ChunkRef *ChunkCatalog::oldest(const std::string &capturerName) const {
+  auto indexIt = mCapturers.find(capturerName);
+  if (indexIt == mCapturers.end() || indexIt->second.inactiveKeys.empty()) {
+    return nullptr;
+  }
+
+  return &mChunks.find(*indexIt->second.inactiveKeys.begin())->second;
+}
+
+std::vector<std::string> ChunkCatalog::capturers() const {
+  std::vector<std::string> names;
+  names.reserve(mCapturers.size());
+  for (const auto &kv : mCapturers) {
+    names.push_back(kv.first);
+  }
+  return names;
+}
+
+uint64_t ChunkCatalog::capturerBytes(const std::string &capturerName) const {
+  auto indexIt = mCapturers.find(capturerName);
+  return indexIt == mCapturers.end() ? 0 : indexIt->second.bytes;
+}
+
+const std::set<std::string> &ChunkCatalog::activePaths() const {
+  return mActivePaths;
+}
+
+uint64_t ChunkCatalog::totalBytes() const { return mTotalBytes; }
+
+size_t ChunkCatalog::size() const { return mChunks.size(); }
+
+void ChunkCatalog::clear() {
+  mChunks.clear();
+  mInactiveKeys.clear();
+  mCapturers.clear();
+  mStartTimes.clear();
+  mActivePaths.clear();
+  mTotalBytes = 0;
+}
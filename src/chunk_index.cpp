@@ -0,0 +1,297 @@
+#include "chunk_index.h"
+#include "file_system.h"
+#include <algorithm>
+#include <cstring>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+ChunkIndex::ChunkIndex() {}
+
+ChunkIndex::~ChunkIndex() { close(); }
+
+bool ChunkIndex::open(const std::string &dir) {
+  close();
+
+#ifdef WIN32
+  (void)dir;
+  return false;
+#else
+  mPath = dir + "/" + CHUNK_INDEX_FILE_NAME;
+
+  mFd = ::open(mPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (mFd < 0) {
+    LOG(ERROR) << "chunk index open failed: " << mPath;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(mFd, &st) != 0) {
+    close();
+    return false;
+  }
+
+  // new or unreadable index, start over
+  Header header;
+  const bool valid =
+      static_cast<size_t>(st.st_size) >= sizeof(Header) &&
+      pread(mFd, &header, sizeof(header), 0) == sizeof(header) &&
+      !memcmp(header.magic, "HHCI", 4) && header.version == VERSION &&
+      header.recordSize == sizeof(ChunkIndexRecord);
+  if (!valid) {
+    if (st.st_size) {
+      LOG(WARNING) << "chunk index is not valid, recreating: " << mPath;
+    }
+
+    memcpy(header.magic, "HHCI", 4);
+    header.version = VERSION;
+    header.recordSize = sizeof(ChunkIndexRecord);
+    header.reserved = 0;
+    if (ftruncate(mFd, 0) != 0 ||
+        pwrite(mFd, &header, sizeof(header), 0) != sizeof(header)) {
+      close();
+      return false;
+    }
+  }
+
+  if (!map()) {
+    close();
+    return false;
+  }
+
+  // drop the removed records and restore the order if the clock went back
+  size_t removed = 0;
+  const ChunkIndexRecord *r = records();
+  for (size_t i = 0; i < mCount; ++i) {
+    removed += (r[i].flags & FLAG_REMOVED) ? 1 : 0;
+    mSorted = mSorted && (!i || r[i - 1].startTime <= r[i].startTime);
+  }
+  if ((removed && removed * 2 >= mCount) || !mSorted) {
+    if (!compact()) {
+      close();
+      return false;
+    }
+  }
+
+  mFileNames.clear();
+  for (size_t i = 0; i < mCount; ++i) {
+    if (!(records()[i].flags & FLAG_REMOVED)) {
+      mFileNames[records()[i].fileName] = i;
+    }
+  }
+
+  return true;
+#endif
+}
+
+bool ChunkIndex::isOpened() const { return mFd >= 0; }
+
+bool ChunkIndex::append(const ChunkIndexRecord &record) {
+#ifdef WIN32
+  (void)record;
+  return false;
+#else
+  if (!isOpened()) {
+    return false;
+  }
+
+  const off_t offset = sizeof(Header) + mCount * sizeof(ChunkIndexRecord);
+  if (pwrite(mFd, &record, sizeof(record), offset) != sizeof(record)) {
+    LOG(ERROR) << "chunk index append failed: " << mPath;
+    return false;
+  }
+
+  if (mCount && records()[mCount - 1].startTime > record.startTime) {
+    mSorted = false;
+  }
+
+  // drop a stale record of the same file, e.g. after a rename back
+  markRemoved(record.fileName);
+
+  // the mapping is reserved ahead, the appended bytes show up in it as the
+  // page cache is shared
+  if (offset + sizeof(record) > mMapSize) {
+    if (!map()) {
+      return false;
+    }
+  } else {
+    mCount++;
+  }
+  mFileNames[record.fileName] = mCount - 1;
+
+  return true;
+#endif
+}
+
+bool ChunkIndex::markRemoved(const std::string &fileName) {
+  auto it = mFileNames.find(fileName);
+  if (it == mFileNames.end()) {
+    return false;
+  }
+
+  // flags are flipped in place through the shared mapping
+  auto *record = const_cast<ChunkIndexRecord *>(records()) + it->second;
+  record->flags |= FLAG_REMOVED;
+  mFileNames.erase(it);
+
+  return true;
+}
+
+const ChunkIndexRecord *ChunkIndex::find(const std::string &fileName) const {
+  auto it = mFileNames.find(fileName);
+  return it == mFileNames.end() ? nullptr : records() + it->second;
+}
+
+void ChunkIndex::query(time_t from, time_t to,
+                       std::vector<ChunkIndexRecord> &result) const {
+  result.clear();
+
+  const ChunkIndexRecord *begin = records();
+  const ChunkIndexRecord *end = begin + mCount;
+
+  // the first chunk starting at from, stepped back over the chunks that
+  // started earlier and still run into the range
+  const ChunkIndexRecord *it = begin;
+  if (mSorted) {
+    it = std::lower_bound(begin, end, from,
+                          [](const ChunkIndexRecord &r, time_t t) {
+                            return r.startTime < t;
+                          });
+    while (it != begin && (it - 1)->endTime > from) {
+      --it;
+    }
+  }
+
+  for (; it != end; ++it) {
+    if (mSorted && it->startTime >= to) {
+      break;
+    }
+
+    if (!(it->flags & FLAG_REMOVED) && it->endTime > from &&
+        it->startTime < to) {
+      result.push_back(*it);
+    }
+  }
+}
+
+size_t ChunkIndex::count() const { return mCount; }
+
+const ChunkIndexRecord &ChunkIndex::at(size_t i) const {
+  return records()[i];
+}
+
+void ChunkIndex::close() {
+  unmap();
+#ifndef WIN32
+  if (mFd >= 0) {
+    ::close(mFd);
+    mFd = -1;
+  }
+#endif
+  mCount = 0;
+  mSorted = true;
+  mFileNames.clear();
+}
+
+bool ChunkIndex::map() {
+#ifdef WIN32
+  return false;
+#else
+  unmap();
+
+  struct stat st;
+  if (fstat(mFd, &st) != 0) {
+    return false;
+  }
+
+  // a torn tail record of a crash is ignored. the mapping is twice the file
+  // so appends remap a logarithmic number of times, only the pages within
+  // the file are ever touched
+  const size_t size = st.st_size;
+  mCount = (size - sizeof(Header)) / sizeof(ChunkIndexRecord);
+  mMapSize = MIN_MAP_SIZE;
+  while (mMapSize < size * 2) {
+    mMapSize *= 2;
+  }
+  mMap = mmap(nullptr, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+  if (mMap == MAP_FAILED) {
+    mMap = nullptr;
+    mMapSize = 0;
+    mCount = 0;
+    LOG(ERROR) << "chunk index mapping failed: " << mPath;
+    return false;
+  }
+
+  return true;
+#endif
+}
+
+void ChunkIndex::unmap() {
+#ifndef WIN32
+  if (mMap) {
+    munmap(mMap, mMapSize);
+    mMap = nullptr;
+    mMapSize = 0;
+  }
+#endif
+}
+
+bool ChunkIndex::compact() {
+#ifdef WIN32
+  return false;
+#else
+  std::vector<ChunkIndexRecord> live;
+  live.reserve(mCount);
+  for (size_t i = 0; i < mCount; ++i) {
+    if (!(records()[i].flags & FLAG_REMOVED)) {
+      live.push_back(records()[i]);
+    }
+  }
+  std::stable_sort(live.begin(), live.end(),
+                   [](const ChunkIndexRecord &l, const ChunkIndexRecord &r) {
+                     return l.startTime < r.startTime;
+                   });
+
+  Header header;
+  if (pread(mFd, &header, sizeof(header), 0) != sizeof(header)) {
+    return false;
+  }
+
+  // rewrite aside and swap, a crash leaves either index intact
+  const std::string tmpPath = mPath + ".tmp";
+  const int fd =
+      ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  const size_t bytes = live.size() * sizeof(ChunkIndexRecord);
+  const bool written =
+      pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      (!bytes || pwrite(fd, live.data(), bytes, sizeof(header)) ==
+                     static_cast<ssize_t>(bytes)) &&
+      fsync(fd) == 0;
+  if (!written || rename(tmpPath.c_str(), mPath.c_str()) != 0) {
+    ::close(fd);
+    unlink(tmpPath.c_str());
+    return false;
+  }
+
+  unmap();
+  ::close(mFd);
+  mFd = fd;
+  mSorted = true;
+
+  return map();
+#endif
+}
+
+const ChunkIndexRecord *ChunkIndex::records() const {
+  return mMap ? reinterpret_cast<const ChunkIndexRecord *>(
+                    static_cast<const char *>(mMap) + sizeof(Header))
+              : nullptr;
+}
@@ -0,0 +1,195 @@
+#include "cv_chunk_writer.h"
+#include <fcntl.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+CvChunkWriter::CvChunkWriter() {}
+
+CvChunkWriter::~CvChunkWriter() { release(); }
+
+bool CvChunkWriter::open(const ChunkWriterParams &params) {
+  mPath = params.path;
+  mEncodePool = params.encodePool;
+  mMemoryBudget = params.memoryBudget;
+  mEncodeCounter = params.encodeCounter;
+  mFrameSize = params.frameSize;
+
+  const int cc = cv::VideoWriter::fourcc(params.fourcc[0], params.fourcc[1],
+                                         params.fourcc[2], params.fourcc[3]);
+  if (!mVideoWriter.open(mPath, cc, params.fps, params.frameSize, true)) {
+    return false;
+  }
+
+#ifndef WIN32
+  // the backend leaves the data to the page cache. synced through an own
+  // descriptor as the file is renamed while being written
+  mSyncFd = ::open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+
+  return true;
+}
+
+bool CvChunkWriter::write(const VideoFrame &vf) {
+  if (vf.frame.empty() && !vf.encoded) {
+    return false;
+  }
+
+  if (!mEncodePool) {
+    writeFrame(vf, 1);
+    mLastFrame = vf;
+    return true;
+  }
+
+  // the frame buffers stay referenced till written. compressed frames are
+  // small and come in bursts, e.g. an event lead-in, only the budget bounds
+  // them
+  PendingFrame p;
+  p.raw = !vf.frame.empty();
+  p.bytes = p.raw ? vf.frame.total() * vf.frame.elemSize() : vf.encoded->size();
+  p.vf = vf;
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (p.raw && mPendingRaw >= MAX_PENDING_FRAMES) {
+      return false;
+    }
+    if (mMemoryBudget) {
+      mMemoryBudget->charge(p.bytes);
+    }
+    mPendingRaw += p.raw ? 1 : 0;
+    mPendingSlots++;
+    mPending.push_back(std::move(p));
+    mLastFrame = vf;
+  }
+  schedule();
+
+  return true;
+}
+
+bool CvChunkWriter::writeRepeat() {
+  if (!mVideoWriter.isOpened()) {
+    return false;
+  }
+
+  if (!mEncodePool) {
+    if (mLastFrame.empty()) {
+      return false;
+    }
+    writeFrame(mLastFrame, 1);
+    return true;
+  }
+
+  // shares the buffers of the previous frame, but is encoded like any other,
+  // so it is refused while the encoder is behind
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mPendingSlots >= MAX_PENDING_FRAMES) {
+      return false;
+    }
+    mPendingSlots++;
+    if (!mPending.empty()) {
+      mPending.back().count++;
+    } else if (!mLastFrame.empty()) {
+      PendingFrame p;
+      p.vf = mLastFrame;
+      mPending.push_back(std::move(p));
+    } else {
+      mPendingSlots--;
+      return false;
+    }
+  }
+  schedule();
+
+  return true;
+}
+
+void CvChunkWriter::schedule() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mEncoding || mPending.empty()) {
+      return;
+    }
+    mEncoding = true;
+  }
+
+  mEncodePool->submit([this]() { encodeNext(); });
+}
+
+void CvChunkWriter::encodeNext() {
+  PendingFrame p;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    p = std::move(mPending.front());
+    mPending.pop_front();
+  }
+
+  writeFrame(p.vf, p.count);
+  if (mMemoryBudget) {
+    mMemoryBudget->release(p.bytes);
+  }
+
+  // one frame per task, the pool stays fair to the other streams
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPendingRaw -= p.raw ? 1 : 0;
+    mPendingSlots -= p.count;
+    if (mPending.empty()) {
+      mEncoding = false;
+      mIdleCondition.notify_all();
+      return;
+    }
+  }
+
+  mEncodePool->submit([this]() { encodeNext(); });
+}
+
+void CvChunkWriter::release() {
+  if (!mVideoWriter.isOpened()) {
+    return;
+  }
+
+  // the queued frames go in first
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdleCondition.wait(lock, [this]() { return !mEncoding; });
+  }
+  mLastFrame = VideoFrame();
+
+  mVideoWriter.release();
+
+#ifndef WIN32
+  if (mSyncFd >= 0) {
+    fdatasync(mSyncFd);
+    ::close(mSyncFd);
+    mSyncFd = -1;
+  }
+#endif
+}
+
+void CvChunkWriter::writeFrame(const VideoFrame &vf, uint32_t count) {
+  const uint64_t startNs = steadyTimeNs();
+  const cv::Mat *frame = &vf.frame;
+
+  // passed through frames have to be decoded for re-encoding
+  if (frame->empty()) {
+    mDecodedFrame = cv::imdecode(*vf.encoded, cv::IMREAD_COLOR);
+    frame = &mDecodedFrame;
+  }
+  if (frame->empty()) {
+    return;
+  }
+
+  if (frame->size() != mFrameSize) {
+    cv::resize(*frame, mScaledFrame, mFrameSize, 0, 0, cv::INTER_AREA);
+    frame = &mScaledFrame;
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    mVideoWriter.write(*frame);
+  }
+  if (mEncodeCounter) {
+    mEncodeCounter->add(steadyTimeNs() - startNs);
+  }
+}
@@ -2,11 +2,12 @@
 #include "file_system.h"
 #include <chrono>
 #include <fstream>
-#include <list>
+#include <set>
 #include <sstream>
 
 FileManager::~FileManager() {
   mExitFlag = true;
+  mWatcher.wakeUp();
   if (mGarbageCollectorThread.joinable()) {
     mGarbageCollectorThread.join();
   }
@@ -31,68 +32,35 @@ bool FileManager::init(const FileManagerParams &params) {
   f.close();
   fs::remove(mParams.recordDir + "_rw_test_file");
 
+  // subscribe before the scan so nothing written in between is missed, the
+  // scan is the only one unless the event queue overflows
+  mWatcher.init(mParams.recordDir);
+  seedCatalog();
+
   // run garbage collector thread
-  if (mParams.recordDirSizeLimitMB) {
-    mGarbageCollectorThread = std::thread([this]() {
-      while (!mExitFlag) {
-
-        const time_t t = std::time(nullptr);
-
-        if (t - mLastCheckTime >= mParams.recordDirSizeCheckIntervalSec) {
-          mLastCheckTime = t;
-
-          int totalSizeMB = 0;
-          std::list<FileRef> mFiles;
-          for (const auto &i :
-               fs::recursive_directory_iterator(mParams.recordDir)) {
-            const auto &p = i.path();
-            if (!fs::is_directory(p) && p.has_extension()) {
-              FileRef ref;
-              ref.path = p;
-              ref.fileName = p.filename();
-              ref.sizeMB = fs::file_size(p) / 1048576; // B to MB
-
-              totalSizeMB += ref.sizeMB;
-
-              mFiles.emplace_back(std::move(ref));
-            }
-          }
-
-          auto FileRefComp = [](const FileRef &l, const FileRef &r) {
-            const Strings &stringsL = split(l.fileName, FILENAME_DELIMITIER);
-            const Strings &stringsR = split(r.fileName, FILENAME_DELIMITIER);
-
-            const bool isVidL = stringsL.size() == 3;
-            const bool isVidR = stringsR.size() == 3;
-            if (isVidL && isVidR) {
-              // both sides are video records
-              return stringTime(stringsL.at(1)) > stringTime(stringsR.at(1));
-            } else if (isVidL || isVidR) {
-              // one side is video record
-              return isVidR;
-            } else {
-              // both sides are not video record
-              return l.fileName > r.fileName;
-            }
-          };
-          mFiles.sort(FileRefComp);
-
-          while (!mFiles.empty() &&
-                 totalSizeMB >= mParams.recordDirSizeLimitMB) {
-
-            const FileRef &f = mFiles.back();
-
-            if (fs::remove(f.path)) {
-              totalSizeMB -= f.sizeMB;
-              LOG(INFO) << "chunk removed due to file size limit: " << f.path;
-            }
-
-            mFiles.pop_back();
-          }
-        }
+  mGarbageCollectorThread = std::thread([this]() {
+    std::vector<WatchEvent> events;
+    uint64_t nextRetentionCheckNs = 0;
+    while (!mExitFlag) {
+      // the chunks being recorded grow without events, their sizes are
+      // polled at a short interval, a stat per stream
+      mWatcher.wait(ACTIVE_CHECK_INTERVAL_MS, events);
+      if (mExitFlag) {
+        break;
       }
-    });
-  }
+
+      // a full pass only if a limit may be crossed, the age limits are
+      // checked at the long interval
+      const uint64_t nowNs = steadyTimeNs();
+      const bool changed = applyEvents(events);
+      const bool overLimit = updateActiveSizes();
+      if (changed || overLimit || nowNs >= nextRetentionCheckNs) {
+        collectGarbage();
+        nextRetentionCheckNs =
+            nowNs + RETENTION_CHECK_INTERVAL_MS * 1000000ULL;
+      }
+    }
+  });
 
   return true;
 }
@@ -119,4 +87,442 @@ std::string FileManager::generateRecordFile(const std::string &capturerName,
        << fileExtension;
 
   return path.str();
-}
\ No newline at end of file
+}
+
+void FileManager::chunkPrepared(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mCatalogMutex);
+  mPreparedPaths.insert(normalizePath(path));
+}
+
+void FileManager::chunkDiscarded(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mCatalogMutex);
+  mPreparedPaths.erase(normalizePath(path));
+  mCatalog.remove(normalizePath(path));
+}
+
+void FileManager::chunkOpened(const std::string &path,
+                              const std::string &preparedPath) {
+  ChunkRef ref;
+  parseRecordFile(normalizePath(path), ref);
+  ref.active = true;
+
+  std::lock_guard<std::mutex> lock(mCatalogMutex);
+  mPreparedPaths.erase(normalizePath(preparedPath));
+  mPreparedPaths.erase(ref.path);
+  mCatalog.add(ref);
+}
+
+void FileManager::chunkClosed(const std::string &path,
+                              const std::string &finalPath,
+                              uint32_t frameCount) {
+  ChunkRef ref;
+  const bool isRecord = parseRecordFile(normalizePath(finalPath), ref);
+
+  std::error_code ec;
+  ref.sizeBytes = fs::file_size(finalPath, ec);
+  if (ec) {
+    ref.sizeBytes = 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mCatalogMutex);
+    mCatalog.remove(normalizePath(path));
+    mCatalog.add(ref);
+
+    ChunkIndex *index = isRecord ? chunkIndex(ref.capturerName) : nullptr;
+    const std::string fileName = fs::path(ref.path).filename().string();
+    if (index && fileName.size() < sizeof(ChunkIndexRecord::fileName)) {
+      ChunkIndexRecord record;
+      record.startTime = ref.startTime;
+      record.endTime = ref.endTime;
+      record.sizeBytes = ref.sizeBytes;
+      record.frameCount = frameCount;
+      fileName.copy(record.fileName, fileName.size());
+      index->append(record);
+    }
+  }
+
+  // let the garbage collector react to the grown record dir
+  mWatcher.wakeUp();
+}
+
+bool FileManager::parseRecordFile(const std::string &path, ChunkRef &ref) {
+  ref.path = path;
+
+  // name#start#end.ext
+  const Strings &strings =
+      split(fs::path(path).filename().string(), FILENAME_DELIMITIER);
+  if (strings.size() != 3) {
+    // not a video record, goes after all records
+    ref.capturerName.clear();
+    ref.startTime = ref.endTime = std::numeric_limits<time_t>::max();
+    return false;
+  }
+
+  ref.capturerName = strings.at(0);
+  ref.startTime = stringTime(strings.at(1));
+  ref.endTime = stringTime(strings.at(2));
+  return true;
+}
+
+void FileManager::seedCatalog() {
+  std::lock_guard<std::mutex> lock(mCatalogMutex);
+
+  // chunks being recorded stay active across a rescan
+  const std::set<std::string> active = mCatalog.activePaths();
+  mCatalog.clear();
+
+  // the finished chunks come from the capturer indexes. the directories are
+  // only listed, the entry types come with the listing and only the files
+  // the indexes do not know are stat'ed
+  size_t indexed = 0;
+  std::error_code ec;
+  for (const auto &dir : fs::directory_iterator(mParams.recordDir, ec)) {
+    if (!dir.is_directory(ec)) {
+      seedFile(dir.path().string(), nullptr, active);
+      continue;
+    }
+
+    // no index is created for directories that are not the capturers'
+    std::error_code dirEc;
+    ChunkIndex *index =
+        fs::exists(dir.path() / CHUNK_INDEX_FILE_NAME, dirEc)
+            ? chunkIndex(dir.path().filename().string())
+            : nullptr;
+    for (const auto &i : fs::directory_iterator(dir.path(), dirEc)) {
+      if (!i.is_directory(dirEc)) {
+        indexed += seedFile(i.path().string(), index, active) ? 1 : 0;
+      }
+    }
+  }
+
+  // forget the chunks removed while not running
+  for (const auto &kv : mChunkIndexes) {
+    ChunkIndex &index = *kv.second;
+    const std::string dir = mParams.recordDir + "/" + kv.first + "/";
+    for (size_t i = 0; i < index.count(); ++i) {
+      const ChunkIndexRecord &record = index.at(i);
+      if (!(record.flags & ChunkIndex::FLAG_REMOVED) &&
+          !mCatalog.find(normalizePath(dir + record.fileName))) {
+        index.markRemoved(record.fileName);
+      }
+    }
+  }
+
+  LOG(INFO) << "record catalog loaded: " << mCatalog.size() << " files ("
+            << indexed << " indexed), " << mCatalog.totalBytes() / 1048576
+            << " MB";
+}
+
+bool FileManager::seedFile(const std::string &path, ChunkIndex *index,
+                           const std::set<std::string> &active) {
+  const fs::path p(path);
+
+  // the chunk indexes and other hidden files are not records
+  const std::string fileName = p.filename().string();
+  if (fileName.empty() || fileName[0] == '.' || !p.has_extension()) {
+    return false;
+  }
+
+  ChunkRef ref;
+  const bool isRecord = parseRecordFile(normalizePath(p.string()), ref);
+  ref.active = active.count(ref.path) > 0;
+  if (mPreparedPaths.count(ref.path)) {
+    return false;
+  }
+
+  // opened ahead and never recorded to when not running anymore
+  if (isPreparedPath(ref.path)) {
+    std::error_code ec;
+    if (fs::remove(p, ec)) {
+      LOG(INFO) << "leftover prepared chunk removed: " << ref.path;
+    }
+    return false;
+  }
+
+  const ChunkIndexRecord *record =
+      isRecord && index && !ref.active &&
+              p.parent_path().filename() == ref.capturerName
+          ? index->find(fileName)
+          : nullptr;
+  if (record) {
+    ref.sizeBytes = record->sizeBytes;
+  } else {
+    std::error_code ec;
+    ref.sizeBytes = fs::file_size(p, ec);
+    if (ec) {
+      return false;
+    }
+  }
+
+  mCatalog.add(ref);
+  return record != nullptr;
+}
+
+bool FileManager::updateActiveSizes() {
+  std::lock_guard<std::mutex> lock(mCatalogMutex);
+
+  // only the chunks being recorded change size on their own
+  std::error_code ec;
+  for (const auto &path : mCatalog.activePaths()) {
+    const uint64_t size = fs::file_size(path, ec);
+    if (!ec) {
+      mCatalog.setSize(path, size);
+    }
+  }
+
+  const uint64_t limitBytes =
+      static_cast<uint64_t>(mParams.recordDirSizeLimitMB) * 1048576;
+  if (limitBytes && mCatalog.totalBytes() >= limitBytes) {
+    return true;
+  }
+  for (const auto &kv : mParams.retentionPolicies) {
+    if (kv.second.maxBytes &&
+        mCatalog.capturerBytes(kv.first) > kv.second.maxBytes) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void FileManager::collectGarbage() {
+  const uint64_t gcStartNs = steadyTimeNs();
+  std::vector<std::string> paths;
+  uint64_t evictedBytes = 0;
+
+  // plan the whole eviction on the catalog, unlink afterwards in one pass
+  {
+    std::lock_guard<std::mutex> lock(mCatalogMutex);
+
+    const time_t now = std::time(nullptr);
+
+    // per capturer limits
+    for (const auto &kv : mParams.retentionPolicies) {
+      const RetentionPolicy &policy = kv.second;
+      while (const ChunkRef *ref = mCatalog.oldest(kv.first)) {
+        const bool tooOld =
+            policy.maxAgeSec && ref->endTime + policy.maxAgeSec < now;
+        const bool tooBig = policy.maxBytes &&
+                            mCatalog.capturerBytes(kv.first) > policy.maxBytes;
+        if (!tooOld && !tooBig) {
+          break;
+        }
+
+        evictedBytes += ref->sizeBytes;
+        paths.push_back(ref->path);
+        mCatalog.remove(paths.back());
+        unindex(paths.back());
+      }
+    }
+
+    // global limit, paid by the capturer that takes the most space
+    const uint64_t limitBytes =
+        static_cast<uint64_t>(mParams.recordDirSizeLimitMB) * 1048576;
+    bool blocked = false;
+    while (limitBytes && mCatalog.totalBytes() >= limitBytes) {
+      const ChunkRef *ref = evictionCandidate(now);
+      if (!ref) {
+        blocked = true;
+        break;
+      }
+
+      evictedBytes += ref->sizeBytes;
+      paths.push_back(ref->path);
+      mCatalog.remove(paths.back());
+      unindex(paths.back());
+    }
+
+    if (blocked && !mRetentionBlocked) {
+      LOG(WARNING) << "record dir size limit exceeded, the remaining chunks "
+                      "are kept by the retention policies";
+    }
+    mRetentionBlocked = blocked;
+  }
+
+  std::error_code ec;
+  for (const auto &path : paths) {
+    if (fs::remove(path, ec)) {
+      LOG(INFO) << "chunk removed due to retention policy: " << path;
+    }
+  }
+
+  mEvictedFiles.fetch_add(paths.size(), std::memory_order_relaxed);
+  mEvictedBytes.fetch_add(evictedBytes, std::memory_order_relaxed);
+  mGcCounter.add(steadyTimeNs() - gcStartNs);
+}
+
+FileManagerStats FileManager::stats() {
+  FileManagerStats s;
+  s.gc = mGcCounter.snapshot();
+  s.evictedFiles = mEvictedFiles.load(std::memory_order_relaxed);
+  s.evictedBytes = mEvictedBytes.load(std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> lock(mCatalogMutex);
+  s.recordBytes = mCatalog.totalBytes();
+  s.recordFiles = mCatalog.size();
+  return s;
+}
+
+const ChunkRef *FileManager::evictionCandidate(time_t now) const {
+  const ChunkRef *candidate = nullptr;
+  uint64_t candidateBytes = 0;
+
+  for (const auto &name : mCatalog.capturers()) {
+    // files that are not video records go last
+    if (name.empty()) {
+      continue;
+    }
+
+    const ChunkRef *ref = mCatalog.oldest(name);
+    if (!ref) {
+      continue;
+    }
+
+    auto policyIt = mParams.retentionPolicies.find(name);
+    if (policyIt != mParams.retentionPolicies.end() &&
+        ref->endTime + policyIt->second.minKeepSec > now) {
+      continue;
+    }
+
+    const uint64_t bytes = mCatalog.capturerBytes(name);
+    if (!candidate || bytes > candidateBytes) {
+      candidate = ref;
+      candidateBytes = bytes;
+    }
+  }
+
+  return candidate ? candidate : mCatalog.oldest(std::string());
+}
+
+bool FileManager::applyEvents(const std::vector<WatchEvent> &events) {
+  for (const auto &e : events) {
+    if (e.type == WatchEventType::OVERFLOW) {
+      LOG(WARNING) << "record dir events lost, rescanning";
+      seedCatalog();
+      return true;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mCatalogMutex);
+
+  const uint64_t totalBytes = mCatalog.totalBytes();
+  const size_t count = mCatalog.size();
+  std::error_code ec;
+  for (const auto &e : events) {
+    const std::string path = normalizePath(e.path);
+
+    // the chunks opened ahead by the out-streams are theirs, they are
+    // renamed when recorded to
+    if (mPreparedPaths.count(path) || isPreparedPath(path)) {
+      continue;
+    }
+
+    if (e.type == WatchEventType::REMOVED) {
+      mCatalog.remove(path);
+      unindex(path);
+      continue;
+    }
+
+    const uint64_t size = fs::file_size(path, ec);
+    if (ec) {
+      // gone again before the event was handled
+      mCatalog.remove(path);
+      unindex(path);
+      continue;
+    }
+
+    // keep the entries of the out-streams, they know if still recording
+    if (!mCatalog.setSize(path, size) && fs::path(path).has_extension()) {
+      ChunkRef ref;
+      parseRecordFile(path, ref);
+      ref.sizeBytes = size;
+      mCatalog.add(ref);
+    }
+  }
+
+  return mCatalog.totalBytes() != totalBytes || mCatalog.size() != count;
+}
+
+std::vector<ChunkRef> FileManager::findChunks(const std::string &capturerName,
+                                              time_t from, time_t to) {
+  std::vector<ChunkRef> chunks;
+
+  std::lock_guard<std::mutex> lock(mCatalogMutex);
+
+  ChunkIndex *index = chunkIndex(capturerName);
+  if (index) {
+    std::vector<ChunkIndexRecord> records;
+    index->query(from, to, records);
+
+    const std::string dir = mParams.recordDir + "/" + capturerName + "/";
+    for (const auto &record : records) {
+      ChunkRef ref;
+      ref.path = normalizePath(dir + record.fileName);
+      ref.capturerName = capturerName;
+      ref.startTime = record.startTime;
+      ref.endTime = record.endTime;
+      ref.sizeBytes = record.sizeBytes;
+      chunks.push_back(ref);
+    }
+  }
+
+  // the chunk being recorded is not indexed yet
+  for (const auto &path : mCatalog.activePaths()) {
+    const ChunkRef *ref = mCatalog.find(path);
+    if (ref && ref->capturerName == capturerName && ref->endTime > from &&
+        ref->startTime < to) {
+      chunks.push_back(*ref);
+    }
+  }
+
+  return chunks;
+}
+
+ChunkIndex *FileManager::chunkIndex(const std::string &capturerName) {
+  auto it = mChunkIndexes.find(capturerName);
+  if (it != mChunkIndexes.end()) {
+    return it->second.get();
+  }
+
+  const std::string dir = mParams.recordDir + "/" + capturerName;
+  if (!fs::is_directory(dir)) {
+    return nullptr;
+  }
+
+  auto index = std::make_unique<ChunkIndex>();
+  if (!index->open(dir)) {
+    return nullptr;
+  }
+
+  return (mChunkIndexes[capturerName] = std::move(index)).get();
+}
+
+void FileManager::unindex(const std::string &path) {
+  ChunkRef ref;
+  if (!parseRecordFile(path, ref)) {
+    return;
+  }
+
+  auto it = mChunkIndexes.find(ref.capturerName);
+  if (it != mChunkIndexes.end()) {
+    it->second->markRemoved(fs::path(path).filename().string());
+  }
+}
+
+bool FileManager::isPreparedPath(const std::string &path) {
+  const size_t len = sizeof(PREPARED_SUFFIX) - 1;
+  return path.size() > len &&
+         path.compare(path.size() - len, len, PREPARED_SUFFIX) == 0;
+}
+
+std::string FileManager::normalizePath(const std::string &path) {
+  std::string res;
+  res.reserve(path.size());
+  for (const char c : path) {
+    if (c != '/' || res.empty() || res.back() != '/') {
+      res.push_back(c);
+    }
+  }
+  return res;
+}
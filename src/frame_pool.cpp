@@ -0,0 +1,66 @@
+#include "frame_pool.h"
+
+FramePool::FramePool() {}
+
+FramePool::~FramePool() {}
+
+bool FramePool::init(const cv::Size &frameSize, int type,
+                     uint32_t initialCount, uint32_t maxCount) {
+  if (frameSize.width <= 0 || frameSize.height <= 0 || maxCount == 0) {
+    return false;
+  }
+
+  mFrameSize = frameSize;
+  mType = type;
+  mMaxCount = std::max(maxCount, initialCount);
+  mNextIndex = 0;
+
+  mBuffers.clear();
+  mBuffers.reserve(mMaxCount);
+  for (uint32_t i = 0; i < initialCount; ++i) {
+    mBuffers.emplace_back(mFrameSize, mType);
+  }
+  mSize = mBuffers.size();
+
+  return true;
+}
+
+cv::Mat FramePool::acquire() {
+  mAcquired++;
+
+  // round robin scan starting after the last handed out buffer, the oldest
+  // buffers are the most likely ones to be released already
+  const size_t count = mBuffers.size();
+  for (size_t i = 0; i < count; ++i) {
+    const size_t index = (mNextIndex + i) % count;
+    if (isFree(mBuffers[index])) {
+      mNextIndex = index + 1;
+      return mBuffers[index];
+    }
+  }
+
+  if (count < mMaxCount) {
+    mGrown++;
+    mBuffers.emplace_back(mFrameSize, mType);
+    mSize = mBuffers.size();
+    mNextIndex = 0;
+    return mBuffers.back();
+  }
+
+  mExhausted++;
+  return cv::Mat(mFrameSize, mType);
+}
+
+FramePoolStats FramePool::stats() const {
+  FramePoolStats s;
+  s.size = mSize;
+  s.acquired = mAcquired;
+  s.grown = mGrown;
+  s.exhausted = mExhausted;
+  return s;
+}
+
+bool FramePool::isFree(const cv::Mat &buffer) {
+  // the pool holds the only reference
+  return buffer.u && CV_XADD(&buffer.u->refcount, 0) == 1;
+}
@@ -0,0 +1,32 @@
+#include "frame_resampler.h"
+
+FrameResampler::FrameResampler() {}
+
+FrameResampler::~FrameResampler() {}
+
+void FrameResampler::reset(uint32_t fps, uint64_t originNs) {
+  mFps = fps ? fps : 1;
+  mOriginNs = originNs;
+  mSlotIndex = 0;
+  mSlotNs = originNs;
+}
+
+bool FrameResampler::hasSlotBefore(uint64_t untilNs) const {
+  return mSlotNs < untilNs;
+}
+
+uint64_t FrameResampler::slotNs() const { return mSlotNs; }
+
+void FrameResampler::advance() {
+  // computed from the origin every time, so the slots never drift
+  ++mSlotIndex;
+  mSlotNs = mOriginNs + (mSlotIndex * 1000000000ULL) / mFps;
+}
+
+bool FrameResampler::preferPrev(uint64_t prevNs, uint64_t nextNs) const {
+  return distanceNs(mSlotNs, prevNs) <= distanceNs(mSlotNs, nextNs);
+}
+
+uint64_t FrameResampler::distanceNs(uint64_t aNs, uint64_t bNs) {
+  return aNs > bNs ? aNs - bNs : bNs - aNs;
+}
@@ -0,0 +1,90 @@
+#include "frame_ring.h"
+
+FrameRing::FrameRing() {}
+
+FrameRing::~FrameRing() {}
+
+bool FrameRing::init(uint32_t capacity, OverflowPolicy policy) {
+  if (capacity == 0) {
+    return false;
+  }
+
+  mCapacity = capacity;
+  mSlotCount = capacity + 1;
+  mPolicy = policy;
+  // the slot buffers are allocated by the first frames at the capture size
+  // and reused from then on as long as the incoming geometry matches
+  mSlots.reset(new RingFrame[mSlotCount]);
+
+  mHead = 0;
+  mTail = 0;
+  mReading = NO_SLOT;
+
+  return true;
+}
+
+RingFrame *FrameRing::acquireWrite() {
+  const uint64_t h = mHead.load(std::memory_order_relaxed);
+  uint64_t t = mTail.load();
+
+  if (h - t >= mCapacity && mPolicy == OverflowPolicy::DROP_NEWEST) {
+    mDroppedNewest++;
+    return nullptr;
+  }
+
+  // never overwrite the slot the consumer is still working on. checked
+  // before the oldest frame is dropped, so a frame is dropped once at most
+  const uint64_t r = mReading.load();
+  if (r != NO_SLOT && (h % mSlotCount) == (r % mSlotCount)) {
+    mDroppedNewest++;
+    return nullptr;
+  }
+
+  // drop the oldest frame, a failed exchange means the consumer took it
+  if (h - t >= mCapacity && mTail.compare_exchange_strong(t, t + 1)) {
+    mDroppedOldest++;
+  }
+
+  return &mSlots[h % mSlotCount];
+}
+
+void FrameRing::commitWrite() {
+  mHead.store(mHead.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+  mPushed++;
+}
+
+RingFrame *FrameRing::acquireRead() {
+  uint64_t t = mTail.load();
+  while (t != mHead.load(std::memory_order_acquire)) {
+    // announce the slot before claiming it, see acquireWrite
+    mReading = t;
+    if (mTail.compare_exchange_strong(t, t + 1)) {
+      return &mSlots[t % mSlotCount];
+    }
+  }
+
+  mReading = NO_SLOT;
+  return nullptr;
+}
+
+void FrameRing::releaseRead() {
+  mReading = NO_SLOT;
+  mPopped++;
+}
+
+uint32_t FrameRing::size() const {
+  const uint64_t t = mTail.load();
+  return static_cast<uint32_t>(mHead.load() - t);
+}
+
+uint32_t FrameRing::capacity() const { return mCapacity; }
+
+FrameRingStats FrameRing::stats() const {
+  FrameRingStats s;
+  s.pushed = mPushed;
+  s.popped = mPopped;
+  s.droppedOldest = mDroppedOldest;
+  s.droppedNewest = mDroppedNewest;
+  return s;
+}
@@ -0,0 +1,68 @@
+#include "io_worker.h"
+
+IoWorker::IoWorker() {}
+
+IoWorker::~IoWorker() { stop(); }
+
+bool IoWorker::init() {
+  if (mThread.joinable()) {
+    return false;
+  }
+
+  mExitFlag = false;
+  mThread = std::thread([this]() { workerLoop(); });
+
+  return true;
+}
+
+void IoWorker::submit(Task &&task) {
+  // tasks of tasks run right away, they are in order already
+  if (!mThread.joinable() || std::this_thread::get_id() == mThread.get_id()) {
+    task();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTasks.emplace_back(std::move(task));
+  }
+  mCondition.notify_one();
+}
+
+void IoWorker::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mExitFlag = true;
+  }
+  mCondition.notify_one();
+
+  if (mThread.joinable()) {
+    mThread.join();
+  }
+}
+
+uint32_t IoWorker::pendingTasks() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mTasks.size();
+}
+
+void IoWorker::workerLoop() {
+  Task task;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mCondition.wait(lock, [this]() { return !mTasks.empty() || mExitFlag; });
+
+      // the queue is drained before leaving
+      if (mTasks.empty()) {
+        break;
+      }
+
+      task = std::move(mTasks.front());
+      mTasks.pop_front();
+    }
+
+    task();
+    task = nullptr;
+  }
+}
@@ -0,0 +1,48 @@
+#include "memory_budget.h"
+#include <algorithm>
+
+MemoryBudget::MemoryBudget() {}
+
+void MemoryBudget::init(uint64_t limitBytes, MemoryBudget *parent) {
+  mLimitBytes = limitBytes;
+  mParent = parent;
+}
+
+void MemoryBudget::charge(uint64_t bytes) {
+  const uint64_t used =
+      mUsedBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+  uint64_t peak = mPeakBytes.load(std::memory_order_relaxed);
+  while (peak < used && !mPeakBytes.compare_exchange_weak(
+                            peak, used, std::memory_order_relaxed)) {
+  }
+
+  if (mParent) {
+    mParent->charge(bytes);
+  }
+}
+
+void MemoryBudget::release(uint64_t bytes) {
+  mUsedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+
+  if (mParent) {
+    mParent->release(bytes);
+  }
+}
+
+double MemoryBudget::pressure() const {
+  const double own =
+      mLimitBytes ? static_cast<double>(mUsedBytes.load(
+                        std::memory_order_relaxed)) /
+                        mLimitBytes
+                  : 0;
+  return mParent ? std::max(own, mParent->pressure()) : own;
+}
+
+MemoryBudgetStats MemoryBudget::stats() const {
+  MemoryBudgetStats s;
+  s.usedBytes = mUsedBytes.load(std::memory_order_relaxed);
+  s.peakBytes = mPeakBytes.load(std::memory_order_relaxed);
+  s.limitBytes = mLimitBytes;
+  return s;
+}
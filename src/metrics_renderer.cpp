@@ -0,0 +1,257 @@
+#include "metrics_renderer.h"
+
+namespace {
+// seconds
+constexpr double HISTOGRAM_BOUNDS[] = {0.00001, 0.00005, 0.0001, 0.0005,
+                                       0.001,   0.005,   0.01,   0.05,
+                                       0.1,     0.5,     1,      5};
+} // namespace
+
+std::string
+MetricsRenderer::render(const std::vector<CapturerMetrics> &capturers,
+                        const FileManagerStats &fileManager,
+                        const MemoryBudgetStats &memory) {
+  std::string out;
+  out.reserve(64 * 1024);
+
+  std::vector<std::string> labels;
+  for (const auto &c : capturers) {
+    labels.push_back(label("capturer", c.name));
+  }
+
+  // samples of a family have to stay together
+  family(out, "househub_stage_duration_seconds", "histogram",
+         "Time spent per frame in a pipeline stage.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    const CapturerStats &s = capturers[i].stats;
+    const std::pair<const char *, const StageStats *> stages[] = {
+        {"grab", &s.grab},
+        {"decode", &s.decode},
+        {"preprocess", &s.preprocess},
+        {"motion", &s.motion},
+        {"process", &s.process},
+        {"watermark", &s.out.watermark},
+        {"write", &s.out.write},
+        {"encode", &s.out.encode},
+        {"rotate", &s.out.rotate},
+        {"finalize", &s.out.finalize}};
+    for (const auto &stage : stages) {
+      histogram(out, "househub_stage_duration_seconds",
+                labels[i] + "," + label("stage", stage.first), *stage.second);
+    }
+  }
+
+  family(out, "househub_stream_up", "gauge",
+         "Whether the in-stream delivers frames.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_stream_up", labels[i],
+           capturers[i].stats.streamHealthy);
+  }
+
+  family(out, "househub_ring_depth", "gauge",
+         "Frames waiting between the grab and the process stage.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_ring_depth", labels[i],
+           capturers[i].stats.ringDepth);
+  }
+
+  family(out, "househub_ring_frames_total", "counter",
+         "Frames through the grab ring by outcome.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    const FrameRingStats &r = capturers[i].stats.ring;
+    const std::pair<const char *, uint64_t> outcomes[] = {
+        {"pushed", r.pushed},
+        {"popped", r.popped},
+        {"dropped_oldest", r.droppedOldest},
+        {"dropped_newest", r.droppedNewest}};
+    for (const auto &o : outcomes) {
+      sample(out, "househub_ring_frames_total",
+             labels[i] + "," + label("outcome", o.first), o.second);
+    }
+  }
+
+  family(out, "househub_slots_total", "counter",
+         "Output frame slots by content.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    const OutStreamStats &o = capturers[i].stats.out;
+    const std::pair<const char *, uint64_t> kinds[] = {
+        {"fresh", o.freshSlots},
+        {"duplicated", o.duplicatedSlots},
+        {"blank", o.blankSlots},
+        {"repeated", o.repeatedFrames}};
+    for (const auto &k : kinds) {
+      sample(out, "househub_slots_total",
+             labels[i] + "," + label("kind", k.first), k.second);
+    }
+  }
+
+  family(out, "househub_backlogged_slots_total", "counter",
+         "Slots left out as the encoder queue was full.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_backlogged_slots_total", labels[i],
+           capturers[i].stats.out.backloggedFrames);
+  }
+
+  family(out, "househub_frames_dropped_total", "counter",
+         "Processed frames no output slot was picked for.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_frames_dropped_total", labels[i],
+           capturers[i].stats.out.droppedFrames);
+  }
+
+  family(out, "househub_chunks_total", "counter", "Chunks opened.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_chunks_total", labels[i],
+           capturers[i].stats.out.chunks);
+  }
+
+  family(out, "househub_io_queue_depth", "gauge",
+         "Tasks waiting on the io worker of the out-stream.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_io_queue_depth", labels[i],
+           capturers[i].stats.out.ioQueueDepth);
+  }
+
+  family(out, "househub_pre_event_bytes", "gauge",
+         "Bytes held by the pre-event buffer.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_pre_event_bytes", labels[i],
+           capturers[i].stats.out.preEventBytes);
+  }
+
+  family(out, "househub_queue_bytes", "gauge",
+         "Frame data of the out-stream waiting for the disk.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_queue_bytes", labels[i],
+           capturers[i].stats.out.queueBytes);
+  }
+
+  family(out, "househub_shed_frames_total", "counter",
+         "Frames degraded or not stored for the memory budget.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    const OutStreamStats &o = capturers[i].stats.out;
+    const std::pair<const char *, uint64_t> actions[] = {
+        {"dropped", o.shedFrames},
+        {"thinned", o.thinnedFrames},
+        {"downscaled", o.downscaledFrames}};
+    for (const auto &a : actions) {
+      sample(out, "househub_shed_frames_total",
+             labels[i] + "," + label("action", a.first), a.second);
+    }
+  }
+
+  family(out, "househub_motion_score", "gauge",
+         "Changed area ratio of the last frame.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_motion_score", labels[i],
+           capturers[i].stats.motionScore);
+  }
+
+  family(out, "househub_motion_frames_total", "counter",
+         "Frames above the motion threshold.");
+  for (size_t i = 0; i < capturers.size(); ++i) {
+    sample(out, "househub_motion_frames_total", labels[i],
+           capturers[i].stats.motionFrames);
+  }
+
+  family(out, "househub_memory_budget_bytes", "gauge",
+         "Queued frame data of all the streams against the budget.");
+  const std::pair<const char *, uint64_t> kinds[] = {
+      {"used", memory.usedBytes},
+      {"peak", memory.peakBytes},
+      {"limit", memory.limitBytes}};
+  for (const auto &k : kinds) {
+    sample(out, "househub_memory_budget_bytes", label("kind", k.first),
+           k.second);
+  }
+
+  family(out, "househub_gc_duration_seconds", "histogram",
+         "Duration of the retention passes.");
+  histogram(out, "househub_gc_duration_seconds", "", fileManager.gc);
+
+  family(out, "househub_evicted_files_total", "counter",
+         "Chunks removed by retention.");
+  sample(out, "househub_evicted_files_total", "", fileManager.evictedFiles);
+
+  family(out, "househub_evicted_bytes_total", "counter",
+         "Bytes removed by retention.");
+  sample(out, "househub_evicted_bytes_total", "", fileManager.evictedBytes);
+
+  family(out, "househub_record_files", "gauge", "Files in the record dir.");
+  sample(out, "househub_record_files", "", fileManager.recordFiles);
+
+  family(out, "househub_record_bytes", "gauge", "Bytes in the record dir.");
+  sample(out, "househub_record_bytes", "", fileManager.recordBytes);
+
+  return out;
+}
+
+void MetricsRenderer::family(std::string &out, const char *name,
+                             const char *type, const char *help) {
+  out += "# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+void MetricsRenderer::sample(std::string &out, const char *name,
+                             const std::string &labels, double value) {
+  char number[32];
+  snprintf(number, sizeof(number), "%.9g", value);
+
+  out += name;
+  if (!labels.empty()) {
+    out += '{';
+    out += labels;
+    out += '}';
+  }
+  out += ' ';
+  out += number;
+  out += '\n';
+}
+
+void MetricsRenderer::histogram(std::string &out, const char *name,
+                                const std::string &labels,
+                                const StageStats &s) {
+  const std::string bucketName = std::string(name) + "_bucket";
+  const std::string prefix = labels.empty() ? "" : labels + ",";
+
+  // a fine bucket counts below a bound once all of it is below, so the
+  // cumulative counts never overstate
+  uint64_t cumulative = 0;
+  uint32_t b = 0;
+  for (double bound : HISTOGRAM_BOUNDS) {
+    const uint64_t boundNs = static_cast<uint64_t>(bound * 1e9);
+    for (; b < s.latency.size() && latencyBucketNs(b) <= boundNs; ++b) {
+      cumulative += s.latency[b];
+    }
+
+    char le[32];
+    snprintf(le, sizeof(le), "%g", bound);
+    sample(out, bucketName.c_str(), prefix + label("le", le), cumulative);
+  }
+  sample(out, bucketName.c_str(), prefix + label("le", "+Inf"), s.frames);
+  sample(out, (std::string(name) + "_sum").c_str(), labels, s.busyNs / 1e9);
+  sample(out, (std::string(name) + "_count").c_str(), labels, s.frames);
+}
+
+std::string MetricsRenderer::label(const char *key, const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+
+  return std::string(key) + "=\"" + escaped + "\"";
+}
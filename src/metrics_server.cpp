@@ -0,0 +1,135 @@
+#include "metrics_server.h"
+#include <cstring>
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+MetricsServer::MetricsServer() {}
+
+MetricsServer::~MetricsServer() { stop(); }
+
+bool MetricsServer::init(const std::string &address, uint16_t port,
+                         Renderer &&renderer) {
+#ifdef WIN32
+  LOG(ERROR) << "metrics endpoint is not supported on this platform";
+  return false;
+#else
+  mRenderer = std::move(renderer);
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+    LOG(ERROR) << "bad metrics address: " << address;
+    return false;
+  }
+
+  mSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  const int one = 1;
+  if (mSocket < 0 ||
+      setsockopt(mSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      bind(mSocket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(mSocket, 8) != 0 || pipe2(mWakeFds, O_CLOEXEC) != 0) {
+    LOG(ERROR) << "metrics endpoint could not listen on " << address << ":"
+               << port << ", " << strerror(errno);
+    stop();
+    return false;
+  }
+
+  mExitFlag = false;
+  mThread = std::thread([this]() { serveLoop(); });
+  LOG(INFO) << "metrics endpoint listening on " << address << ":" << port;
+
+  return true;
+#endif
+}
+
+void MetricsServer::stop() {
+  mExitFlag = true;
+
+#ifndef WIN32
+  if (mWakeFds[1] >= 0) {
+    (void)!write(mWakeFds[1], "x", 1);
+  }
+  if (mThread.joinable()) {
+    mThread.join();
+  }
+
+  for (int *fd : {&mSocket, &mWakeFds[0], &mWakeFds[1]}) {
+    if (*fd >= 0) {
+      ::close(*fd);
+      *fd = -1;
+    }
+  }
+#endif
+}
+
+void MetricsServer::serveLoop() {
+#ifndef WIN32
+  while (!mExitFlag) {
+    pollfd fds[2] = {{mSocket, POLLIN, 0}, {mWakeFds[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) <= 0 || (fds[1].revents & POLLIN)) {
+      continue;
+    }
+
+    const int client = accept4(mSocket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client >= 0) {
+      serve(client);
+      ::close(client);
+    }
+  }
+#endif
+}
+
+void MetricsServer::serve(int client) {
+#ifndef WIN32
+  // a stuck scraper costs a second at most
+  timeval tv{1, 0};
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  // only the request line matters
+  char request[2048];
+  size_t size = 0;
+  while (size < sizeof(request) - 1) {
+    const ssize_t n =
+        recv(client, request + size, sizeof(request) - 1 - size, 0);
+    if (n <= 0) {
+      break;
+    }
+    size += n;
+    request[size] = '\0';
+    if (strstr(request, "\r\n\r\n")) {
+      break;
+    }
+  }
+  request[size] = '\0';
+
+  const bool metrics = strncmp(request, "GET /metrics ", 13) == 0 ||
+                       strncmp(request, "GET /metrics?", 13) == 0;
+  const std::string body = metrics ? mRenderer() : "not found\n";
+  const std::string response =
+      std::string(metrics ? "HTTP/1.0 200 OK\r\n"
+                          : "HTTP/1.0 404 Not Found\r\n") +
+      "Content-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+      std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+  size_t sent = 0;
+  while (sent < response.size()) {
+    const ssize_t n = send(client, response.data() + sent,
+                           response.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      break;
+    }
+    sent += n;
+  }
+#else
+  (void)client;
+#endif
+}
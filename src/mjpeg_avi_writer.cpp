@@ -0,0 +1,200 @@
+#include "mjpeg_avi_writer.h"
+
+namespace {
+constexpr uint32_t AVIF_HASINDEX = 0x10;
+constexpr uint32_t AVIIF_KEYFRAME = 0x10;
+constexpr uint32_t AVI_RATE_SCALE = 1000;
+} // namespace
+
+MjpegAviWriter::MjpegAviWriter() {}
+
+MjpegAviWriter::~MjpegAviWriter() { release(); }
+
+bool MjpegAviWriter::open(const ChunkWriterParams &params) {
+  release();
+
+  if (!mFile.open(params)) {
+    return false;
+  }
+
+  mFps = params.fps > 0 ? params.fps : 10;
+  mFrameSize = params.frameSize;
+  mFrameCount = 0;
+  mMaxFrameSize = 0;
+  mIndex.clear();
+
+  writeHeaders();
+
+  return mFile.good();
+}
+
+bool MjpegAviWriter::write(const VideoFrame &vf) {
+  if (!mFile.isOpened()) {
+    return false;
+  }
+
+  if (vf.encoded) {
+    return writeFrameChunk(vf.encoded->data(), vf.encoded->size());
+  }
+
+  if (vf.frame.empty() ||
+      !cv::imencode(".jpg", vf.frame, mEncodeBuffer,
+                    {cv::IMWRITE_JPEG_QUALITY, JPEG_QUALITY})) {
+    return false;
+  }
+
+  return writeFrameChunk(mEncodeBuffer.data(), mEncodeBuffer.size());
+}
+
+bool MjpegAviWriter::writeRepeat() {
+  // an empty chunk repeats the previous frame
+  if (!mFile.isOpened() || !mFrameCount) {
+    return false;
+  }
+
+  return writeFrameChunk(nullptr, 0);
+}
+
+void MjpegAviWriter::release() {
+  if (!mFile.isOpened()) {
+    return;
+  }
+
+  // index
+  const uint64_t idx1Offset = mFile.tell();
+  putFourcc("idx1");
+  putU32(mIndex.size() / 2 * 16);
+  for (size_t i = 0; i < mIndex.size(); i += 2) {
+    putFourcc("00dc");
+    putU32(mIndex[i + 1] ? AVIIF_KEYFRAME : 0);
+    putU32(mIndex[i]);
+    putU32(mIndex[i + 1]);
+  }
+  const uint64_t fileSize = mFile.tell();
+
+  // sizes and counts known only now
+  patchU32(4, fileSize - 8);
+  patchU32(mMoviOffset - 4, idx1Offset - mMoviOffset);
+  patchU32(mTotalFramesOffset, mFrameCount);
+  patchU32(mLengthOffset, mFrameCount);
+  patchU32(mSuggestedBufferOffset, mMaxFrameSize);
+
+  mFile.close();
+}
+
+bool MjpegAviWriter::writeFrameChunk(const uchar *data, size_t size) {
+  const uint64_t offset = mFile.tell();
+
+  putFourcc("00dc");
+  putU32(size);
+  mFile.write(data, size);
+  if (size % 2) {
+    putU8(0); // chunks are word aligned
+  }
+
+  mIndex.push_back(offset - mMoviOffset);
+  mIndex.push_back(size);
+  mMaxFrameSize = std::max<uint32_t>(mMaxFrameSize, size);
+  mFrameCount++;
+
+  return mFile.good();
+}
+
+void MjpegAviWriter::writeHeaders() {
+  const uint32_t w = mFrameSize.width;
+  const uint32_t h = mFrameSize.height;
+
+  putFourcc("RIFF");
+  putU32(0); // patched on release
+  putFourcc("AVI ");
+
+  // hdrl = "hdrl" + avih chunk + strl list
+  putFourcc("LIST");
+  putU32(4 + (8 + 56) + (8 + 116));
+  putFourcc("hdrl");
+
+  putFourcc("avih");
+  putU32(56);
+  putU32(static_cast<uint32_t>(1000000 / mFps)); // micro sec per frame
+  putU32(0);                                     // max bytes per sec
+  putU32(0);                                     // padding granularity
+  putU32(AVIF_HASINDEX);
+  mTotalFramesOffset = mFile.tell();
+  putU32(0); // total frames, patched on release
+  putU32(0); // initial frames
+  putU32(1); // streams
+  putU32(0); // suggested buffer size
+  putU32(w);
+  putU32(h);
+  for (int i = 0; i < 4; ++i) {
+    putU32(0); // reserved
+  }
+
+  // strl = "strl" + strh chunk + strf chunk
+  putFourcc("LIST");
+  putU32(116);
+  putFourcc("strl");
+
+  putFourcc("strh");
+  putU32(56);
+  putFourcc("vids");
+  putFourcc("MJPG");
+  putU32(0); // flags
+  putU16(0); // priority
+  putU16(0); // language
+  putU32(0); // initial frames
+  putU32(AVI_RATE_SCALE);
+  putU32(static_cast<uint32_t>(mFps * AVI_RATE_SCALE + 0.5));
+  putU32(0); // start
+  mLengthOffset = mFile.tell();
+  putU32(0); // length, patched on release
+  mSuggestedBufferOffset = mFile.tell();
+  putU32(0);          // suggested buffer size, patched on release
+  putU32(0xFFFFFFFF); // quality
+  putU32(0);          // sample size
+  putU16(0);
+  putU16(0);
+  putU16(w);
+  putU16(h);
+
+  // bitmap info header
+  putFourcc("strf");
+  putU32(40);
+  putU32(40);
+  putU32(w);
+  putU32(h);
+  putU16(1);  // planes
+  putU16(24); // bit count
+  putFourcc("MJPG");
+  putU32(w * h * 3);
+  putU32(0);
+  putU32(0);
+  putU32(0);
+  putU32(0);
+
+  putFourcc("LIST");
+  putU32(0); // patched on release
+  mMoviOffset = mFile.tell();
+  putFourcc("movi");
+}
+
+void MjpegAviWriter::putU32(uint32_t v) {
+  const uchar b[4] = {uchar(v), uchar(v >> 8), uchar(v >> 16), uchar(v >> 24)};
+  mFile.write(b, 4);
+}
+
+void MjpegAviWriter::putU16(uint16_t v) {
+  const uchar b[2] = {uchar(v), uchar(v >> 8)};
+  mFile.write(b, 2);
+}
+
+void MjpegAviWriter::putU8(uint8_t v) { mFile.write(&v, 1); }
+
+void MjpegAviWriter::putFourcc(const char *fourcc) {
+  mFile.write(fourcc, 4);
+}
+
+void MjpegAviWriter::patchU32(uint64_t offset, uint32_t v) {
+  const uchar b[4] = {uchar(v), uchar(v >> 8), uchar(v >> 16), uchar(v >> 24)};
+  mFile.patch(offset, b, 4);
+}
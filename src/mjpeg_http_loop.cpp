@@ -0,0 +1,625 @@
+#include "mjpeg_http_loop.h"
+#include "mjpeg_http_stream.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <netdb.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+const char *findToken(const char *begin, const char *end, const char *token,
+                      size_t length) {
+  return static_cast<const char *>(memmem(begin, end - begin, token, length));
+}
+
+// "--" + boundary, decided on the first part, the bare token only if the
+// server leaves the dashes out, as the bare one may well occur in the jpeg data
+const char *findDelimiter(const char *begin, const char *end,
+                          const std::string &boundary, std::string &delimiter) {
+  if (!delimiter.empty()) {
+    return findToken(begin, end, delimiter.data(), delimiter.size());
+  }
+
+  const char *b = findToken(begin, end, boundary.data(), boundary.size());
+  if (!b) {
+    return nullptr;
+  }
+  if (b - begin >= 2 && b[-2] == '-' && b[-1] == '-') {
+    delimiter = "--" + boundary;
+    return b - 2;
+  }
+  delimiter = boundary;
+  return b;
+}
+
+// case insensitive header lookup in [begin, end), without copying
+bool headerValue(const char *begin, const char *end, const char *key,
+                 const char *&value, const char *&valueEnd) {
+  const size_t keyLength = strlen(key);
+  for (const char *line = begin; line < end;) {
+    const char *lineEnd = findToken(line, end, "\r\n", 2);
+    if (!lineEnd) {
+      lineEnd = end;
+    }
+
+    if (static_cast<size_t>(lineEnd - line) > keyLength &&
+        strncasecmp(line, key, keyLength) == 0 && line[keyLength] == ':') {
+      value = line + keyLength + 1;
+      while (value < lineEnd && (*value == ' ' || *value == '\t')) {
+        ++value;
+      }
+      valueEnd = lineEnd;
+      return true;
+    }
+
+    line = lineEnd + 2;
+  }
+
+  return false;
+}
+
+// numeric hosts only, a name lookup would block the loop thread
+bool resolveNumeric(const std::string &host, const std::string &port,
+                    addrinfo *&res) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  res = nullptr;
+  return getaddrinfo(host.c_str(), port.c_str(), &hints, &res) == 0;
+}
+#endif
+} // namespace
+
+MjpegHttpLoop::MjpegHttpLoop() {}
+
+MjpegHttpLoop::~MjpegHttpLoop() { stop(); }
+
+bool MjpegHttpLoop::add(IMjpegSink *sink,
+                        const MjpegHttpSourceParams &params) {
+#ifdef __linux__
+  std::unique_ptr<Source> s(new Source());
+  std::string path;
+  if (!MjpegHttpStream::parseUri(params.uri, s->host, s->port, path)) {
+    LOG(ERROR) << "bad mjpeg http stream uri: " << params.uri;
+    return false;
+  }
+
+  addrinfo *res = nullptr;
+  if (!resolveNumeric(s->host, s->port, res)) {
+    LOG(ERROR) << "mjpeg http stream host has to be an ip address, names "
+                  "are resolved by the default capturer type: "
+               << params.uri;
+    return false;
+  }
+  freeaddrinfo(res);
+
+  // http/1.0 keeps the body free of chunked transfer encoding
+  s->sink = sink;
+  s->params = params;
+  s->request = "GET " + path + " HTTP/1.0\r\nHost: " + s->host +
+               "\r\nConnection: close\r\n\r\n";
+  s->backoff.init(params.reconnectMinMs, params.reconnectMaxMs);
+  s->buffer.resize(4 * READ_SIZE);
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mThread.joinable() && !start()) {
+    return false;
+  }
+  mAdded.push_back(std::move(s));
+  wakeUp();
+
+  return true;
+#else
+  (void)sink;
+  LOG(ERROR) << "mjpeg http loop is not supported on this platform: "
+             << params.uri;
+  return false;
+#endif
+}
+
+void MjpegHttpLoop::remove(IMjpegSink *sink) {
+  std::unique_lock<std::mutex> lock(mMutex);
+  if (!mThread.joinable()) {
+    return;
+  }
+
+  mRemoved.push_back(sink);
+  wakeUp();
+  mCondition.wait(lock, [this, sink]() {
+    return std::find(mRemoved.begin(), mRemoved.end(), sink) ==
+           mRemoved.end();
+  });
+}
+
+void MjpegHttpLoop::stop() {
+  mExitFlag = true;
+  wakeUp();
+  if (mThread.joinable()) {
+    mThread.join();
+  }
+
+#ifdef __linux__
+  if (mWakeFd >= 0) {
+    ::close(mWakeFd);
+    mWakeFd = -1;
+  }
+  if (mEpollFd >= 0) {
+    ::close(mEpollFd);
+    mEpollFd = -1;
+  }
+#endif
+}
+
+bool MjpegHttpLoop::start() {
+#ifdef __linux__
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  if (mEpollFd < 0 || mWakeFd < 0 ||
+      epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev) != 0) {
+    LOG(ERROR) << "mjpeg http loop cannot be started";
+    return false;
+  }
+
+  mExitFlag = false;
+  mThread = std::thread([this]() { loop(); });
+  LOG(INFO) << "mjpeg http loop started.";
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+void MjpegHttpLoop::wakeUp() {
+#ifdef __linux__
+  if (mWakeFd >= 0) {
+    const uint64_t one = 1;
+    (void)!write(mWakeFd, &one, sizeof(one));
+  }
+#endif
+}
+
+void MjpegHttpLoop::loop() {
+#ifdef __linux__
+  epoll_event events[64];
+
+  while (!mExitFlag) {
+    applyChanges();
+
+    // sleep till the nearest connect, stall or backoff deadline, at most a
+    // second for the ticks
+    uint64_t now = steadyTimeNs();
+    uint64_t waitNs = 1000000000;
+    for (const auto &s : mSources) {
+      waitNs = std::min(waitNs, s->deadlineNs > now ? s->deadlineNs - now : 0);
+    }
+
+    const int n = epoll_wait(mEpollFd, events, 64, (waitNs + 999999) / 1000000);
+    for (int i = 0; i < n; ++i) {
+      if (!events[i].data.ptr) {
+        uint64_t value;
+        (void)!read(mWakeFd, &value, sizeof(value));
+        continue;
+      }
+
+      handleEvent(*static_cast<Source *>(events[i].data.ptr), events[i].events);
+    }
+
+    now = steadyTimeNs();
+    for (auto &s : mSources) {
+      if (now < s->deadlineNs) {
+        continue;
+      }
+
+      if (s->state == State::BACKOFF) {
+        connect(*s);
+      } else {
+        fail(*s, s->state < State::BOUNDARY ? "connect timeout" : "stalled");
+      }
+    }
+
+    // keep the out-streams ticking while no frame arrives
+    const time_t t = std::time(nullptr);
+    if (t != mLastTickTime) {
+      mLastTickTime = t;
+      for (auto &s : mSources) {
+        s->sink->tick();
+      }
+    }
+  }
+
+  for (auto &s : mSources) {
+    closeSource(*s);
+  }
+  mSources.clear();
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  mAdded.clear();
+  mRemoved.clear();
+  mCondition.notify_all();
+#endif
+}
+
+void MjpegHttpLoop::applyChanges() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto &s : mAdded) {
+    mSources.push_back(std::move(s));
+  }
+  mAdded.clear();
+
+  if (mRemoved.empty()) {
+    return;
+  }
+
+  for (IMjpegSink *sink : mRemoved) {
+    auto it = std::find_if(
+        mSources.begin(), mSources.end(),
+        [sink](const std::unique_ptr<Source> &s) { return s->sink == sink; });
+    if (it != mSources.end()) {
+      closeSource(**it);
+      mSources.erase(it);
+    }
+  }
+  mRemoved.clear();
+  mCondition.notify_all();
+}
+
+void MjpegHttpLoop::connect(Source &s) {
+#ifdef __linux__
+  s.state = State::CONNECTING;
+  s.deadlineNs = steadyTimeNs() + s.params.connectTimeoutMs * 1000000ULL;
+  s.begin = 0;
+  s.end = 0;
+  s.sent = 0;
+  s.unsupported = false;
+
+  // checked by add, this does not block
+  addrinfo *res = nullptr;
+  if (!resolveNumeric(s.host, s.port, res)) {
+    fail(s, "bad address");
+    return;
+  }
+
+  s.fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                res->ai_protocol);
+  const bool connecting =
+      s.fd >= 0 && (::connect(s.fd, res->ai_addr, res->ai_addrlen) == 0 ||
+                    errno == EINPROGRESS);
+  freeaddrinfo(res);
+
+  epoll_event ev{};
+  ev.events = EPOLLOUT;
+  ev.data.ptr = &s;
+  if (!connecting || epoll_ctl(mEpollFd, EPOLL_CTL_ADD, s.fd, &ev) != 0) {
+    fail(s, "connect failed");
+  }
+#endif
+}
+
+void MjpegHttpLoop::fail(Source &s, const char *reason) {
+  closeSource(s);
+
+  if (s.healthy) {
+    s.healthy = false;
+    s.sink->streamChanged(false);
+  }
+
+  const uint64_t waitMs = s.backoff.nextDelayMs();
+  s.state = State::BACKOFF;
+  s.deadlineNs = steadyTimeNs() + waitMs * 1000000;
+
+  if (s.backoff.attempts() == 1 || waitMs >= 10000) {
+    LOG(INFO) << "mjpeg http stream " << reason << ", reconnect in " << waitMs
+              << " ms: " << s.params.name;
+  }
+}
+
+void MjpegHttpLoop::handleEvent(Source &s, uint32_t events) {
+#ifdef __linux__
+  if (s.state == State::CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if ((events & EPOLLERR) ||
+        getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+      fail(s, "connect failed");
+      return;
+    }
+    s.state = State::REQUEST;
+  }
+
+  if (s.state == State::REQUEST) {
+    if (!sendRequest(s)) {
+      fail(s, "request failed");
+    }
+    return;
+  }
+
+  if (!receive(s)) {
+    fail(s, s.unsupported ? "is not multipart" : "closed");
+  }
+#endif
+}
+
+bool MjpegHttpLoop::sendRequest(Source &s) {
+#ifdef __linux__
+  const ssize_t n = send(s.fd, s.request.data() + s.sent,
+                         s.request.size() - s.sent, MSG_NOSIGNAL);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+
+  s.sent += n;
+  if (s.sent == s.request.size()) {
+    s.state = State::HEADERS;
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &s;
+    return epoll_ctl(mEpollFd, EPOLL_CTL_MOD, s.fd, &ev) == 0;
+  }
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool MjpegHttpLoop::receive(Source &s) {
+#ifdef __linux__
+  s.receiveStartNs = steadyTimeNs();
+
+  ssize_t n;
+  if (s.state == State::BODY) {
+    // straight into the payload, through the buffer when it is dropped
+    const size_t left = s.payloadSize - s.payloadFill;
+    n = s.payload ? recv(s.fd, s.payload->data() + s.payloadFill, left, 0)
+                  : recv(s.fd, s.buffer.data(),
+                         std::min(left, s.buffer.size()), 0);
+    if (n > 0) {
+      s.payloadFill += n;
+      if (s.payloadFill == s.payloadSize) {
+        commitPayload(s);
+      }
+    }
+  } else {
+    // compact, then make room
+    if (s.begin > 0 && (s.begin == s.end || s.begin > s.buffer.size() / 2)) {
+      std::memmove(s.buffer.data(), s.buffer.data() + s.begin,
+                   s.end - s.begin);
+      s.end -= s.begin;
+      s.begin = 0;
+    }
+    if (s.buffer.size() - s.end < READ_SIZE) {
+      s.buffer.resize(s.buffer.size() + 4 * READ_SIZE);
+    }
+
+    n = recv(s.fd, s.buffer.data() + s.end, s.buffer.size() - s.end, 0);
+    if (n > 0) {
+      s.end += n;
+      if (!parse(s)) {
+        return false;
+      }
+    }
+  }
+
+  if (n <= 0) {
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+  }
+
+  if (s.state == State::BODY || s.state == State::SCAN_BODY) {
+    s.payloadBusyNs += steadyTimeNs() - s.receiveStartNs;
+  }
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool MjpegHttpLoop::parse(Source &s) {
+#ifdef __linux__
+  while (true) {
+    const char *begin = s.buffer.data() + s.begin;
+    const char *end = s.buffer.data() + s.end;
+
+    switch (s.state) {
+    case State::HEADERS:
+    case State::PART_HEADERS: {
+      const char *h = findToken(begin, end, "\r\n\r\n", 4);
+      if (!h) {
+        return static_cast<size_t>(end - begin) <= MAX_HEADERS_SIZE;
+      }
+
+      if (s.state == State::PART_HEADERS) {
+        beginPayload(s, h);
+      } else if (!parseResponse(s, h)) {
+        return false;
+      }
+      break;
+    }
+
+    case State::BOUNDARY: {
+      const char *b = findDelimiter(begin, end, s.boundary, s.delimiter);
+      if (!b) {
+        // keep the tail, the delimiter may be split between reads
+        const size_t tail = s.boundary.size() + 2;
+        s.begin = std::max(s.begin, s.end - std::min(s.end, tail));
+        return true;
+      }
+
+      s.begin = b - s.buffer.data() + s.delimiter.size();
+      s.state = State::PART_HEADERS;
+      break;
+    }
+
+    case State::BODY: {
+      // the buffered head of the payload, the rest is received in place
+      const size_t n =
+          std::min(s.payloadSize - s.payloadFill, s.end - s.begin);
+      if (s.payload) {
+        std::memcpy(s.payload->data() + s.payloadFill, begin, n);
+      }
+      s.payloadFill += n;
+      s.begin += n;
+      if (s.payloadFill < s.payloadSize) {
+        return true;
+      }
+
+      commitPayload(s);
+      break;
+    }
+
+    case State::SCAN_BODY: {
+      // no content-length, the payload ends at the next delimiter
+      const char *b = findDelimiter(begin, end, s.boundary, s.delimiter);
+      if (!b) {
+        return static_cast<size_t>(end - begin) <= MAX_PART_SIZE;
+      }
+
+      // the line break, and the dashes of a bare delimiter, are not payload
+      const char *e = b;
+      if (s.delimiter.size() == s.boundary.size() && e - begin >= 2 &&
+          e[-2] == '-' && e[-1] == '-') {
+        e -= 2;
+      }
+      if (e - begin >= 2 && e[-2] == '\r' && e[-1] == '\n') {
+        e -= 2;
+      }
+      if (s.payload) {
+        s.payload->assign(begin, e);
+      }
+      s.begin = b - s.buffer.data();
+      commitPayload(s);
+      break;
+    }
+
+    default:
+      return true;
+    }
+  }
+#else
+  (void)s;
+  return false;
+#endif
+}
+
+bool MjpegHttpLoop::parseResponse(Source &s, const char *headersEnd) {
+#ifdef __linux__
+  const char *begin = s.buffer.data() + s.begin;
+  const char *statusEnd = findToken(begin, headersEnd, "\r\n", 2);
+  if (!statusEnd) {
+    statusEnd = headersEnd;
+  }
+  if (!findToken(begin, statusEnd, " 200", 4)) {
+    return false;
+  }
+
+  // boundary=xxx, the leading "--" is optional in the wild, the stream
+  // tells whether the delimiter has it
+  const char *value, *valueEnd;
+  const char *b = nullptr;
+  if (headerValue(statusEnd, headersEnd, "content-type", value, valueEnd) &&
+      findToken(value, valueEnd, "multipart", 9)) {
+    b = findToken(value, valueEnd, "boundary=", 9);
+  }
+  if (!b) {
+    s.unsupported = true;
+    return false;
+  }
+
+  std::string boundary(b + 9, valueEnd);
+  boundary.erase(std::remove(boundary.begin(), boundary.end(), '"'),
+                 boundary.end());
+  boundary = boundary.substr(0, boundary.find_first_of("; \r"));
+  if (boundary.compare(0, 2, "--") == 0) {
+    boundary.erase(0, 2);
+  }
+  if (boundary.empty()) {
+    s.unsupported = true;
+    return false;
+  }
+
+  s.boundary = boundary;
+  s.delimiter.clear();
+  s.begin = headersEnd + 4 - s.buffer.data();
+  s.state = State::BOUNDARY;
+  s.deadlineNs = steadyTimeNs() + s.params.stallTimeoutSec * 1000000000ULL;
+
+  return true;
+#else
+  (void)s;
+  (void)headersEnd;
+  return false;
+#endif
+}
+
+void MjpegHttpLoop::beginPayload(Source &s, const char *headersEnd) {
+#ifdef __linux__
+  const char *begin = s.buffer.data() + s.begin;
+  const char *value, *valueEnd;
+  size_t length = 0;
+  if (headerValue(begin, headersEnd, "content-length", value, valueEnd)) {
+    for (; value < valueEnd && *value >= '0' && *value <= '9'; ++value) {
+      length = std::min(length * 10 + (*value - '0'), MAX_PART_SIZE + 1);
+    }
+  }
+
+  s.begin = headersEnd + 4 - s.buffer.data();
+  s.payload = s.sink->acquireJpeg();
+  s.payloadFill = 0;
+  s.payloadBusyNs = 0;
+
+  if (length > 0 && length <= MAX_PART_SIZE) {
+    s.payloadSize = length;
+    if (s.payload) {
+      s.payload->resize(length);
+    }
+    s.state = State::BODY;
+  } else {
+    s.payloadSize = 0;
+    s.state = State::SCAN_BODY;
+  }
+#else
+  (void)s;
+  (void)headersEnd;
+#endif
+}
+
+void MjpegHttpLoop::commitPayload(Source &s) {
+  const uint64_t now = steadyTimeNs();
+  if (s.payload) {
+    s.sink->commitJpeg(s.payloadBusyNs + now - s.receiveStartNs);
+    s.payload = nullptr;
+  }
+  s.payloadBusyNs = 0;
+  s.receiveStartNs = now;
+  s.state = State::BOUNDARY;
+  s.deadlineNs = now + s.params.stallTimeoutSec * 1000000000ULL;
+
+  if (!s.healthy) {
+    s.healthy = true;
+    s.backoff.reset();
+    s.sink->streamChanged(true);
+  }
+}
+
+void MjpegHttpLoop::closeSource(Source &s) {
+#ifdef __linux__
+  if (s.fd >= 0) {
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, s.fd, nullptr);
+    ::close(s.fd);
+    s.fd = -1;
+  }
+#endif
+  s.payload = nullptr;
+}
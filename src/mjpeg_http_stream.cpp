@@ -0,0 +1,353 @@
+#include "mjpeg_http_stream.h"
+#include <algorithm>
+#include <cstring>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+MjpegHttpStream::MjpegHttpStream() {}
+
+MjpegHttpStream::~MjpegHttpStream() { close(); }
+
+bool MjpegHttpStream::open(const std::string &uri, int timeoutMs) {
+  close();
+  mUnsupported = false;
+
+#ifdef WIN32
+  LOG(ERROR) << "mjpeg http stream is not supported on this platform: "
+             << uri;
+  return false;
+#else
+  std::string host, port, path;
+  if (!parseUri(uri, host, port, path)) {
+    return false;
+  }
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *res = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+    return false;
+  }
+
+  // non-blocking connect, so a dead camera costs at most the timeout
+  for (addrinfo *ai = res; ai && mSocket < 0; ai = ai->ai_next) {
+    const int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (s < 0) {
+      continue;
+    }
+
+    const int flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, flags | O_NONBLOCK);
+
+    bool connected = connect(s, ai->ai_addr, ai->ai_addrlen) == 0;
+    if (!connected && errno == EINPROGRESS) {
+      pollfd pfd{s, POLLOUT, 0};
+      int err = 0;
+      socklen_t len = sizeof(err);
+      connected = poll(&pfd, 1, timeoutMs) == 1 &&
+                  getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len) == 0 &&
+                  err == 0;
+    }
+
+    if (connected) {
+      fcntl(s, F_SETFL, flags);
+      timeval tv{timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+      setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+      mSocket = s;
+    } else {
+      ::close(s);
+    }
+  }
+  freeaddrinfo(res);
+
+  if (mSocket < 0) {
+    return false;
+  }
+
+  // http/1.0 keeps the body free of chunked transfer encoding
+  const std::string request = "GET " + path + " HTTP/1.0\r\nHost: " + host +
+                              "\r\nConnection: close\r\n\r\n";
+  if (send(mSocket, request.data(), request.size(), MSG_NOSIGNAL) !=
+      static_cast<ssize_t>(request.size())) {
+    close();
+    return false;
+  }
+
+  std::string headers;
+  if (!readHeaders(headers) || headers.find(" 200") == std::string::npos) {
+    close();
+    return false;
+  }
+
+  // boundary=xxx, the leading "--" is optional in the wild
+  const std::string contentType = headerValue(headers, "content-type");
+  const size_t b = contentType.find("boundary=");
+  mUnsupported = contentType.find("multipart") == std::string::npos ||
+                 b == std::string::npos;
+  if (mUnsupported) {
+    close();
+    return false;
+  }
+
+  mBoundary = contentType.substr(b + 9);
+  mBoundary.erase(std::remove(mBoundary.begin(), mBoundary.end(), '"'),
+                  mBoundary.end());
+  mBoundary = mBoundary.substr(0, mBoundary.find_first_of("; \r"));
+  if (mBoundary.compare(0, 2, "--") == 0) {
+    mBoundary.erase(0, 2);
+  }
+  mDelimiter.clear();
+
+  return !mBoundary.empty();
+#endif
+}
+
+bool MjpegHttpStream::isOpened() const { return mSocket >= 0; }
+
+void MjpegHttpStream::setReadTimeout(int timeoutMs) {
+#ifndef WIN32
+  if (mSocket >= 0) {
+    timeval tv{timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    setsockopt(mSocket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+#endif
+}
+
+bool MjpegHttpStream::isUnsupported() const { return mUnsupported; }
+
+bool MjpegHttpStream::read(std::vector<uchar> &jpeg) {
+  if (mSocket < 0) {
+    return false;
+  }
+
+  // part boundary
+  size_t pos;
+  while ((pos = findDelimiter(mBegin)) == std::string::npos) {
+    // keep the tail, the delimiter may be split between reads
+    const size_t tail = mBoundary.size() + 2;
+    mBegin = std::max(mBegin, mEnd > tail ? mEnd - tail : mBegin);
+    if (!fill()) {
+      return false;
+    }
+  }
+  mBegin = pos + mDelimiter.size();
+
+  // part headers
+  std::string headers;
+  if (!readHeaders(headers)) {
+    return false;
+  }
+
+  const std::string lengthValue = headerValue(headers, "content-length");
+  if (!lengthValue.empty()) {
+    const size_t length = std::strtoul(lengthValue.c_str(), nullptr, 10);
+    if (length == 0 || length > MAX_PART_SIZE) {
+      return false;
+    }
+
+    while (mEnd - mBegin < length) {
+      if (!fill()) {
+        return false;
+      }
+    }
+
+    jpeg.assign(mBuffer.begin() + mBegin, mBuffer.begin() + mBegin + length);
+    mBegin += length;
+    return true;
+  }
+
+  // no length, the payload ends at the next boundary
+  while ((pos = findDelimiter(mBegin)) == std::string::npos) {
+    if (mEnd - mBegin > MAX_PART_SIZE || !fill()) {
+      return false;
+    }
+  }
+
+  // cut the line break, and the dashes of a bare delimiter, in front of it
+  size_t end = pos;
+  if (mDelimiter.size() == mBoundary.size() && end - mBegin >= 2 &&
+      mBuffer[end - 2] == '-' && mBuffer[end - 1] == '-') {
+    end -= 2;
+  }
+  if (end - mBegin >= 2 && mBuffer[end - 2] == '\r' &&
+      mBuffer[end - 1] == '\n') {
+    end -= 2;
+  }
+
+  jpeg.assign(mBuffer.begin() + mBegin, mBuffer.begin() + end);
+  mBegin = pos; // the boundary belongs to the next part
+  return !jpeg.empty();
+}
+
+void MjpegHttpStream::close() {
+#ifndef WIN32
+  if (mSocket >= 0) {
+    ::close(mSocket);
+  }
+#endif
+  mSocket = -1;
+  mBegin = mEnd = 0;
+}
+
+bool MjpegHttpStream::parseUri(const std::string &uri, std::string &host,
+                               std::string &port, std::string &path) {
+  const std::string scheme = "http://";
+  if (uri.compare(0, scheme.size(), scheme) != 0) {
+    return false;
+  }
+
+  const size_t hostBegin = scheme.size();
+  const size_t pathBegin = uri.find('/', hostBegin);
+  const std::string authority = uri.substr(hostBegin, pathBegin - hostBegin);
+  path = pathBegin == std::string::npos ? "/" : uri.substr(pathBegin);
+
+  const size_t colon = authority.rfind(':');
+  if (colon != std::string::npos) {
+    host = authority.substr(0, colon);
+    port = authority.substr(colon + 1);
+  } else {
+    host = authority;
+    port = "80";
+  }
+
+  return !host.empty() && !port.empty();
+}
+
+bool MjpegHttpStream::jpegSize(const std::vector<uchar> &jpeg,
+                               cv::Size &size) {
+  const size_t n = jpeg.size();
+  if (n < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+    return false;
+  }
+
+  // walk the marker segments up to the start of frame
+  size_t i = 2;
+  while (i + 4 <= n) {
+    if (jpeg[i] != 0xFF) {
+      return false;
+    }
+
+    const uchar marker = jpeg[i + 1];
+    if (marker == 0xFF) {
+      ++i; // fill byte
+      continue;
+    }
+
+    const size_t length = (jpeg[i + 2] << 8) | jpeg[i + 3];
+    const bool sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+                     marker != 0xC8 && marker != 0xCC;
+    if (sof) {
+      if (i + 9 > n) {
+        return false;
+      }
+      size.height = (jpeg[i + 5] << 8) | jpeg[i + 6];
+      size.width = (jpeg[i + 7] << 8) | jpeg[i + 8];
+      return true;
+    }
+
+    if (marker == 0xDA) {
+      return false; // start of scan before any frame header
+    }
+
+    i += 2 + length;
+  }
+
+  return false;
+}
+
+bool MjpegHttpStream::fill() {
+#ifdef WIN32
+  return false;
+#else
+  // compact, then make room
+  if (mBegin > 0 && (mBegin == mEnd || mBegin > mBuffer.size() / 2)) {
+    std::memmove(mBuffer.data(), mBuffer.data() + mBegin, mEnd - mBegin);
+    mEnd -= mBegin;
+    mBegin = 0;
+  }
+  if (mBuffer.size() - mEnd < 65536) {
+    mBuffer.resize(mBuffer.size() + 262144);
+  }
+
+  const ssize_t n =
+      recv(mSocket, mBuffer.data() + mEnd, mBuffer.size() - mEnd, 0);
+  if (n <= 0) {
+    close();
+    return false;
+  }
+
+  mEnd += n;
+  return true;
+#endif
+}
+
+size_t MjpegHttpStream::find(const std::string &token, size_t from) const {
+  const auto begin = mBuffer.begin() + from;
+  const auto end = mBuffer.begin() + mEnd;
+  const auto it = std::search(begin, end, token.begin(), token.end());
+  return it == end ? std::string::npos : it - mBuffer.begin();
+}
+
+size_t MjpegHttpStream::findDelimiter(size_t from) {
+  if (!mDelimiter.empty()) {
+    return find(mDelimiter, from);
+  }
+
+  // the first one tells whether the server sends the dashes
+  const size_t pos = find(mBoundary, from);
+  if (pos == std::string::npos) {
+    return pos;
+  }
+  if (pos >= from + 2 && mBuffer[pos - 2] == '-' && mBuffer[pos - 1] == '-') {
+    mDelimiter = "--" + mBoundary;
+    return pos - 2;
+  }
+  mDelimiter = mBoundary;
+  return pos;
+}
+
+bool MjpegHttpStream::readHeaders(std::string &headers) {
+  size_t pos;
+  while ((pos = find("\r\n\r\n", mBegin)) == std::string::npos) {
+    if (mEnd - mBegin > 65536 || !fill()) {
+      return false;
+    }
+  }
+
+  headers.assign(mBuffer.begin() + mBegin, mBuffer.begin() + pos);
+  mBegin = pos + 4;
+  return true;
+}
+
+std::string MjpegHttpStream::headerValue(const std::string &headers,
+                                         const std::string &key) {
+  std::string lower = headers;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+  size_t pos = 0;
+  while ((pos = lower.find(key, pos)) != std::string::npos) {
+    // the key has to start a line and be followed by a colon
+    const bool lineStart = pos == 0 || lower[pos - 1] == '\n';
+    const size_t colon = pos + key.size();
+    if (lineStart && colon < lower.size() && lower[colon] == ':') {
+      const size_t valueBegin = headers.find_first_not_of(" \t", colon + 1);
+      const size_t valueEnd = headers.find("\r\n", colon);
+      if (valueBegin == std::string::npos || valueBegin >= valueEnd) {
+        return "";
+      }
+      return headers.substr(valueBegin, valueEnd - valueBegin);
+    }
+    pos = colon;
+  }
+
+  return "";
+}
@@ -0,0 +1,96 @@
+#include "motion_detector.h"
+
+MotionDetector::MotionDetector() {}
+
+MotionDetector::~MotionDetector() {}
+
+bool MotionDetector::init(const MotionDetectorParams &params) {
+  if (params.scale == 0 || params.learningRate <= 0 ||
+      params.learningRate > 1) {
+    return false;
+  }
+
+  mParams = params;
+  mBackground.release();
+
+  return true;
+}
+
+double MotionDetector::update(const cv::Mat &frame) {
+  if (frame.empty() || frame.type() != CV_8UC3) {
+    return 0;
+  }
+
+  sampleThumbnail(frame);
+  return updateThumbnail();
+}
+
+double MotionDetector::updateEncoded(const std::vector<uchar> &jpeg) {
+  // the jpeg decoder scales by 2, 4 or 8 while decoding
+  const int flag = mParams.scale >= 8   ? cv::IMREAD_REDUCED_GRAYSCALE_8
+                   : mParams.scale >= 4 ? cv::IMREAD_REDUCED_GRAYSCALE_4
+                   : mParams.scale >= 2 ? cv::IMREAD_REDUCED_GRAYSCALE_2
+                                        : cv::IMREAD_GRAYSCALE;
+  cv::imdecode(jpeg, flag, &mThumbnail);
+  if (mThumbnail.empty()) {
+    return 0;
+  }
+
+  return updateThumbnail();
+}
+
+bool MotionDetector::isMotion(double score) const {
+  return score >= mParams.areaThreshold;
+}
+
+bool MotionDetector::isStill() const { return mStill; }
+
+double MotionDetector::updateThumbnail() {
+  const cv::Size size = mThumbnail.size();
+
+  // still if close to the reference, the new reference otherwise
+  uint32_t changed = size.area();
+  if (mReference.size() == size) {
+    changed = countChanged(mThumbnail, mReference);
+  }
+  mStill = changed < mParams.stillThreshold * size.area();
+  if (!mStill) {
+    mThumbnail.copyTo(mReference);
+  }
+
+  // (re)start the background from this frame
+  if (mBackground.size() != size) {
+    mThumbnail.convertTo(mBackground, CV_32F);
+    return 0;
+  }
+
+  mBackground.convertTo(mBackgroundGray, CV_8U);
+  const uint32_t moving = countChanged(mThumbnail, mBackgroundGray);
+  cv::accumulateWeighted(mThumbnail, mBackground, mParams.learningRate);
+
+  return static_cast<double>(moving) / size.area();
+}
+
+void MotionDetector::sampleThumbnail(const cv::Mat &frame) {
+  const int scale = mParams.scale;
+  const cv::Size size(frame.cols / scale, frame.rows / scale);
+  mThumbnail.create(size, CV_8UC1);
+
+  // every scale-th pixel of every scale-th row, bt.601 luma in fixed point
+  for (int y = 0; y < size.height; ++y) {
+    const uchar *src = frame.ptr<uchar>(y * scale);
+    uchar *dst = mThumbnail.ptr<uchar>(y);
+    for (int x = 0; x < size.width; ++x) {
+      const uchar *p = src + x * scale * 3;
+      dst[x] = (29 * p[0] + 150 * p[1] + 77 * p[2]) >> 8;
+    }
+  }
+}
+
+uint32_t MotionDetector::countChanged(const cv::Mat &cur,
+                                      const cv::Mat &ref) {
+  cv::absdiff(cur, ref, mDiff);
+  cv::threshold(mDiff, mDiff, mParams.pixelThreshold, 255,
+                cv::THRESH_BINARY);
+  return cv::countNonZero(mDiff);
+}
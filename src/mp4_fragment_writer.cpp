@@ -0,0 +1,390 @@
+#include "mp4_fragment_writer.h"
+#include "mjpeg_avi_writer.h"
+#include <cmath>
+
+namespace {
+constexpr uint32_t TRACK_ID = 1;
+constexpr uint8_t MJPEG_OBJECT_TYPE = 0x6C;
+constexpr uint32_t SYNC_SAMPLE_FLAGS = 0x02000000; // depends on no other
+
+// tfhd and trun flags
+constexpr uint32_t TFHD_DEFAULT_DURATION = 0x000008;
+constexpr uint32_t TFHD_DEFAULT_FLAGS = 0x000020;
+constexpr uint32_t TFHD_DEFAULT_BASE_IS_MOOF = 0x020000;
+constexpr uint32_t TRUN_DATA_OFFSET = 0x000001;
+constexpr uint32_t TRUN_SAMPLE_DURATION = 0x000100;
+constexpr uint32_t TRUN_SAMPLE_SIZE = 0x000200;
+
+constexpr uint32_t MATRIX[9] = {0x00010000, 0, 0, 0, 0x00010000, 0,
+                                0,          0, 0x40000000};
+} // namespace
+
+Mp4FragmentWriter::Mp4FragmentWriter() {}
+
+Mp4FragmentWriter::~Mp4FragmentWriter() { release(); }
+
+bool Mp4FragmentWriter::open(const ChunkWriterParams &params) {
+  release();
+
+  if (!mFile.open(params)) {
+    return false;
+  }
+
+  const double fps = params.fps > 0 ? params.fps : 10;
+  mFrameSize = params.frameSize;
+  mSampleDuration = static_cast<uint32_t>(std::lround(TIMESCALE / fps));
+  mFragmentDuration = std::max<uint64_t>(
+      1, static_cast<uint64_t>(params.fragmentSec) * TIMESCALE);
+  mPendingDuration = 0;
+  mSequence = 0;
+  mDecodeTime = 0;
+  mSampleSizes.clear();
+  mSampleDurations.clear();
+  mSamples.clear();
+
+  writeInitSegment();
+
+  // the empty file is playable as well
+  mFile.sync();
+
+  return mFile.good();
+}
+
+bool Mp4FragmentWriter::write(const VideoFrame &vf) {
+  if (!mFile.isOpened()) {
+    return false;
+  }
+
+  if (vf.encoded) {
+    return addSample(vf.encoded->data(), vf.encoded->size());
+  }
+
+  if (vf.frame.empty() ||
+      !cv::imencode(".jpg", vf.frame, mEncodeBuffer,
+                    {cv::IMWRITE_JPEG_QUALITY, MjpegAviWriter::JPEG_QUALITY})) {
+    return false;
+  }
+
+  return addSample(mEncodeBuffer.data(), mEncodeBuffer.size());
+}
+
+bool Mp4FragmentWriter::writeRepeat() {
+  // a repeat right after a fragment went out is stored as a new sample
+  if (!mFile.isOpened() || mSampleDurations.empty()) {
+    return false;
+  }
+
+  mSampleDurations.back() += mSampleDuration;
+  mPendingDuration += mSampleDuration;
+  if (mPendingDuration >= mFragmentDuration) {
+    return writeFragment();
+  }
+
+  return mFile.good();
+}
+
+void Mp4FragmentWriter::release() {
+  if (!mFile.isOpened()) {
+    return;
+  }
+
+  writeFragment();
+  mFile.close();
+}
+
+bool Mp4FragmentWriter::addSample(const uchar *data, size_t size) {
+  mSamples.insert(mSamples.end(), data, data + size);
+  mSampleSizes.push_back(size);
+  mSampleDurations.push_back(mSampleDuration);
+
+  mPendingDuration += mSampleDuration;
+  if (mPendingDuration >= mFragmentDuration) {
+    return writeFragment();
+  }
+
+  return mFile.good();
+}
+
+bool Mp4FragmentWriter::writeFragment() {
+  if (mSampleSizes.empty()) {
+    return mFile.good();
+  }
+
+  mBox.clear();
+
+  const size_t moof = beginBox("moof");
+
+  const size_t mfhd = beginFullBox("mfhd", 0, 0);
+  putU32(++mSequence);
+  endBox(mfhd);
+
+  const size_t traf = beginBox("traf");
+
+  const size_t tfhd = beginFullBox(
+      "tfhd", 0,
+      TFHD_DEFAULT_DURATION | TFHD_DEFAULT_FLAGS | TFHD_DEFAULT_BASE_IS_MOOF);
+  putU32(TRACK_ID);
+  putU32(mSampleDuration);
+  putU32(SYNC_SAMPLE_FLAGS);
+  endBox(tfhd);
+
+  const size_t tfdt = beginFullBox("tfdt", 1, 0);
+  putU64(mDecodeTime);
+  endBox(tfdt);
+
+  const size_t trun = beginFullBox(
+      "trun", 0, TRUN_DATA_OFFSET | TRUN_SAMPLE_DURATION | TRUN_SAMPLE_SIZE);
+  putU32(mSampleSizes.size());
+  const size_t dataOffsetPos = mBox.size();
+  putU32(0); // patched below
+  for (size_t i = 0; i < mSampleSizes.size(); ++i) {
+    putU32(mSampleDurations[i]);
+    putU32(mSampleSizes[i]);
+  }
+  endBox(trun);
+
+  endBox(traf);
+  endBox(moof);
+
+  // samples start right after the mdat header
+  patchU32(dataOffsetPos, mBox.size() + 8);
+
+  putU32(8 + mSamples.size());
+  put("mdat", 4);
+
+  mFile.write(mBox.data(), mBox.size());
+  mFile.write(mSamples.data(), mSamples.size());
+
+  // the fragment is on disk before the next one starts
+  mFile.sync();
+
+  mDecodeTime += mPendingDuration;
+  mPendingDuration = 0;
+  mSampleSizes.clear();
+  mSampleDurations.clear();
+  mSamples.clear();
+
+  return mFile.good();
+}
+
+void Mp4FragmentWriter::writeInitSegment() {
+  const uint32_t w = mFrameSize.width;
+  const uint32_t h = mFrameSize.height;
+
+  mBox.clear();
+
+  const size_t ftyp = beginBox("ftyp");
+  put("isom", 4);
+  putU32(0x200);
+  put("isomiso5iso6mp41", 16);
+  endBox(ftyp);
+
+  const size_t moov = beginBox("moov");
+
+  const size_t mvhd = beginFullBox("mvhd", 0, 0);
+  putU32(0); // creation time
+  putU32(0); // modification time
+  putU32(TIMESCALE);
+  putU32(0); // duration, given by the fragments
+  putU32(0x00010000); // rate
+  putU16(0x0100);     // volume
+  putU16(0);
+  putU32(0);
+  putU32(0);
+  for (const uint32_t v : MATRIX) {
+    putU32(v);
+  }
+  for (int i = 0; i < 6; ++i) {
+    putU32(0); // pre defined
+  }
+  putU32(TRACK_ID + 1); // next track id
+  endBox(mvhd);
+
+  const size_t trak = beginBox("trak");
+
+  const size_t tkhd = beginFullBox("tkhd", 0, 0x000003); // enabled, in movie
+  putU32(0);
+  putU32(0);
+  putU32(TRACK_ID);
+  putU32(0);
+  putU32(0); // duration
+  putU32(0);
+  putU32(0);
+  putU16(0); // layer
+  putU16(0); // alternate group
+  putU16(0); // volume
+  putU16(0);
+  for (const uint32_t v : MATRIX) {
+    putU32(v);
+  }
+  putU32(w << 16);
+  putU32(h << 16);
+  endBox(tkhd);
+
+  const size_t mdia = beginBox("mdia");
+
+  const size_t mdhd = beginFullBox("mdhd", 0, 0);
+  putU32(0);
+  putU32(0);
+  putU32(TIMESCALE);
+  putU32(0);
+  putU16(0x55C4); // und
+  putU16(0);
+  endBox(mdhd);
+
+  const size_t hdlr = beginFullBox("hdlr", 0, 0);
+  putU32(0);
+  put("vide", 4);
+  putU32(0);
+  putU32(0);
+  putU32(0);
+  put("VideoHandler", 13);
+  endBox(hdlr);
+
+  const size_t minf = beginBox("minf");
+
+  const size_t vmhd = beginFullBox("vmhd", 0, 1);
+  putU16(0); // graphics mode
+  putU16(0);
+  putU16(0);
+  putU16(0);
+  endBox(vmhd);
+
+  const size_t dinf = beginBox("dinf");
+  const size_t dref = beginFullBox("dref", 0, 0);
+  putU32(1);
+  endBox(beginFullBox("url ", 0, 1)); // media in this file
+  endBox(dref);
+  endBox(dinf);
+
+  const size_t stbl = beginBox("stbl");
+
+  const size_t stsd = beginFullBox("stsd", 0, 0);
+  putU32(1);
+
+  // visual sample entry, mp4v with the jpeg object type
+  const size_t mp4v = beginBox("mp4v");
+  for (int i = 0; i < 6; ++i) {
+    putU8(0);
+  }
+  putU16(1); // data reference index
+  putU16(0);
+  putU16(0);
+  putU32(0);
+  putU32(0);
+  putU32(0);
+  putU16(w);
+  putU16(h);
+  putU32(0x00480000); // 72 dpi
+  putU32(0x00480000);
+  putU32(0);
+  putU16(1); // frame count
+  for (int i = 0; i < 32; ++i) {
+    putU8(0); // compressor name
+  }
+  putU16(0x0018); // depth
+  putU16(0xFFFF);
+
+  const size_t esds = beginFullBox("esds", 0, 0);
+  putU8(0x03); // es descriptor
+  putU8(21);
+  putU16(TRACK_ID);
+  putU8(0);
+  putU8(0x04); // decoder config descriptor
+  putU8(13);
+  putU8(MJPEG_OBJECT_TYPE);
+  putU8(0x11); // visual stream
+  putU8(0);    // buffer size
+  putU16(0);
+  putU32(0); // max bitrate
+  putU32(0); // avg bitrate
+  putU8(0x06); // sl config descriptor
+  putU8(1);
+  putU8(0x02);
+  endBox(esds);
+
+  endBox(mp4v);
+  endBox(stsd);
+
+  // the samples are described by the fragments
+  const size_t stts = beginFullBox("stts", 0, 0);
+  putU32(0);
+  endBox(stts);
+
+  const size_t stsc = beginFullBox("stsc", 0, 0);
+  putU32(0);
+  endBox(stsc);
+
+  const size_t stsz = beginFullBox("stsz", 0, 0);
+  putU32(0);
+  putU32(0);
+  endBox(stsz);
+
+  const size_t stco = beginFullBox("stco", 0, 0);
+  putU32(0);
+  endBox(stco);
+
+  endBox(stbl);
+  endBox(minf);
+  endBox(mdia);
+  endBox(trak);
+
+  const size_t mvex = beginBox("mvex");
+  const size_t trex = beginFullBox("trex", 0, 0);
+  putU32(TRACK_ID);
+  putU32(1); // sample description index
+  putU32(mSampleDuration);
+  putU32(0);
+  putU32(SYNC_SAMPLE_FLAGS);
+  endBox(trex);
+  endBox(mvex);
+
+  endBox(moov);
+
+  mFile.write(mBox.data(), mBox.size());
+}
+
+size_t Mp4FragmentWriter::beginBox(const char *type) {
+  const size_t pos = mBox.size();
+  putU32(0); // patched on end
+  put(type, 4);
+  return pos;
+}
+
+size_t Mp4FragmentWriter::beginFullBox(const char *type, uint8_t version,
+                                       uint32_t flags) {
+  const size_t pos = beginBox(type);
+  putU32((static_cast<uint32_t>(version) << 24) | (flags & 0xFFFFFF));
+  return pos;
+}
+
+void Mp4FragmentWriter::endBox(size_t pos) {
+  patchU32(pos, mBox.size() - pos);
+}
+
+void Mp4FragmentWriter::put(const void *data, size_t size) {
+  const auto *bytes = static_cast<const uchar *>(data);
+  mBox.insert(mBox.end(), bytes, bytes + size);
+}
+
+void Mp4FragmentWriter::putU8(uint8_t v) { mBox.push_back(v); }
+
+void Mp4FragmentWriter::putU16(uint16_t v) {
+  putU8(v >> 8);
+  putU8(v);
+}
+
+void Mp4FragmentWriter::putU32(uint32_t v) {
+  putU16(v >> 16);
+  putU16(v);
+}
+
+void Mp4FragmentWriter::putU64(uint64_t v) {
+  putU32(v >> 32);
+  putU32(v);
+}
+
+void Mp4FragmentWriter::patchU32(size_t pos, uint32_t v) {
+  const uchar b[4] = {uchar(v >> 24), uchar(v >> 16), uchar(v >> 8), uchar(v)};
+  std::copy(b, b + 4, mBox.begin() + pos);
+}
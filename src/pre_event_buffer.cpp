@@ -0,0 +1,48 @@
+#include "pre_event_buffer.h"
+
+PreEventBuffer::PreEventBuffer() {}
+
+PreEventBuffer::~PreEventBuffer() {}
+
+void PreEventBuffer::init(uint64_t maxBytes, uint32_t maxFrames) {
+  clear();
+  mMaxBytes = maxBytes;
+  mMaxFrames = maxFrames;
+}
+
+void PreEventBuffer::push(VideoFrame &&vf) {
+  if (!vf.encoded || !mMaxBytes || !mMaxFrames) {
+    return;
+  }
+
+  mBytes += vf.encoded->size();
+  mFrames.emplace_back(std::move(vf));
+
+  // the oldest frames go first, the newest one is always kept
+  while (mFrames.size() > 1 &&
+         (mBytes > mMaxBytes || mFrames.size() > mMaxFrames)) {
+    mBytes -= mFrames.front().encoded->size();
+    mFrames.pop_front();
+  }
+}
+
+bool PreEventBuffer::pop(VideoFrame &vf) {
+  if (mFrames.empty()) {
+    return false;
+  }
+
+  vf = std::move(mFrames.front());
+  mFrames.pop_front();
+  mBytes -= vf.encoded->size();
+
+  return true;
+}
+
+bool PreEventBuffer::empty() const { return mFrames.empty(); }
+
+uint64_t PreEventBuffer::bytes() const { return mBytes; }
+
+void PreEventBuffer::clear() {
+  mFrames.clear();
+  mBytes = 0;
+}
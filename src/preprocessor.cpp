@@ -0,0 +1,137 @@
+#include "preprocessor.h"
+
+Preprocessor::Preprocessor() {}
+
+Preprocessor::~Preprocessor() {}
+
+bool Preprocessor::init(const PreprocessorParams &params) {
+  if (params.outputSize.width <= 0 || params.outputSize.height <= 0) {
+    return false;
+  }
+
+  mParams = params;
+  mParams.stripeRows = std::max(8u, mParams.stripeRows);
+  mParams.threads = std::max(1u, mParams.threads);
+
+  // median kernel has to be odd
+  mKernelSize = mParams.filterK > 1
+                    ? (mParams.filterK % 2 ? mParams.filterK
+                                           : mParams.filterK + 1)
+                    : 0;
+
+  // flip_x mirrors the rows (cv::flip code 0), flip_y the columns (code 1)
+  mFlipRows = mParams.flipX;
+  mFlipCols = mParams.flipY;
+
+  mMapSrcSize = cv::Size();
+
+  return true;
+}
+
+void Preprocessor::process(const cv::Mat &src, cv::Mat &dst) {
+  if (src.empty()) {
+    return;
+  }
+
+  if (src.size() != mMapSrcSize) {
+    buildMaps(src.size());
+  }
+
+  dst.create(mParams.outputSize, src.type());
+
+  const int rows = mParams.outputSize.height;
+  const int stripeRows = mParams.stripeRows;
+  const int stripes = (rows + stripeRows - 1) / stripeRows;
+
+  if (mParams.threads > 1) {
+    cv::parallel_for_(
+        cv::Range(0, stripes),
+        [&](const cv::Range &r) {
+          for (int s = r.start; s < r.end; ++s) {
+            processStripe(src, dst, s * stripeRows,
+                          std::min(rows, (s + 1) * stripeRows));
+          }
+        },
+        mParams.threads);
+  } else {
+    for (int s = 0; s < stripes; ++s) {
+      processStripe(src, dst, s * stripeRows,
+                    std::min(rows, (s + 1) * stripeRows));
+    }
+  }
+}
+
+void Preprocessor::buildMaps(const cv::Size &srcSize) {
+  mMapSrcSize = srcSize;
+
+  const cv::Size &out = mParams.outputSize;
+  mIdentity = srcSize == out && !mFlipRows && !mFlipCols;
+  if (mIdentity) {
+    mMap1.release();
+    mMap2.release();
+    return;
+  }
+
+  // pixel center aligned mapping, same as cv::resize with linear
+  // interpolation, mirrored when flipping
+  const float sx = static_cast<float>(srcSize.width) / out.width;
+  const float sy = static_cast<float>(srcSize.height) / out.height;
+
+  cv::Mat mapX(out, CV_32FC1);
+  cv::Mat mapY(out, CV_32FC1);
+  for (int y = 0; y < out.height; ++y) {
+    const int fy = mFlipRows ? out.height - 1 - y : y;
+    const float srcY = (fy + 0.5f) * sy - 0.5f;
+    float *mx = mapX.ptr<float>(y);
+    float *my = mapY.ptr<float>(y);
+    for (int x = 0; x < out.width; ++x) {
+      const int fx = mFlipCols ? out.width - 1 - x : x;
+      mx[x] = (fx + 0.5f) * sx - 0.5f;
+      my[x] = srcY;
+    }
+  }
+
+  // fixed point maps are considerably faster to remap with
+  cv::convertMaps(mapX, mapY, mMap1, mMap2, CV_16SC2);
+}
+
+void Preprocessor::processStripe(const cv::Mat &src, cv::Mat &dst, int y0,
+                                 int y1) const {
+  // stripe rows plus the halo the median filter needs, clipped to the frame
+  const int halo = mKernelSize / 2;
+  const int h0 = std::max(0, y0 - halo);
+  const int h1 = std::min(dst.rows, y1 + halo);
+
+  cv::Mat dstStripe = dst.rowRange(y0, y1);
+
+  if (!mKernelSize) {
+    if (mIdentity) {
+      src.rowRange(y0, y1).copyTo(dstStripe);
+    } else {
+      cv::remap(src, dstStripe, mMap1.rowRange(y0, y1),
+                mMap2.rowRange(y0, y1), cv::INTER_LINEAR,
+                cv::BORDER_REPLICATE);
+    }
+    return;
+  }
+
+  // reused per thread, a stripe is small enough to stay in the cache
+  thread_local cv::Mat stripe;
+  thread_local cv::Mat filtered;
+
+  if (mIdentity) {
+    stripe = src.rowRange(h0, h1);
+  } else {
+    stripe.create(h1 - h0, dst.cols, dst.type());
+    cv::remap(src, stripe, mMap1.rowRange(h0, h1), mMap2.rowRange(h0, h1),
+              cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+  }
+
+  cv::medianBlur(stripe, filtered, mKernelSize);
+  filtered.rowRange(y0 - h0, y1 - h0).copyTo(dstStripe);
+
+  // do not keep a reference to the source frame
+  if (mIdentity) {
+    stripe.release();
+  }
+}
@@ -0,0 +1,205 @@
+#include "record_dir_watcher.h"
+#include "file_system.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+// no IN_MODIFY, every write of a chunk being recorded would be an event.
+// the out-streams report their chunks themselves and the file manager polls
+// their sizes
+constexpr uint32_t WATCH_MASK = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE |
+                                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                                IN_ONLYDIR;
+#endif
+} // namespace
+
+RecordDirWatcher::RecordDirWatcher() {}
+
+RecordDirWatcher::~RecordDirWatcher() { close(); }
+
+bool RecordDirWatcher::init(const std::string &dir) {
+  close();
+
+#ifdef __linux__
+  mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (mInotifyFd < 0) {
+    LOG(WARNING) << "inotify is not available, record dir is not watched";
+    return false;
+  }
+
+  if (pipe2(mWakeFds, O_NONBLOCK | O_CLOEXEC) != 0) {
+    close();
+    return false;
+  }
+
+  // files found while subscribing are already known to the caller's scan
+  std::vector<WatchEvent> events;
+  addWatch(dir, events);
+  if (mWatchDirs.empty()) {
+    LOG(WARNING) << "record dir watch failed: " << dir;
+    close();
+    return false;
+  }
+
+  return true;
+#else
+  (void)dir;
+  return false;
+#endif
+}
+
+bool RecordDirWatcher::isOpened() const { return mInotifyFd >= 0; }
+
+void RecordDirWatcher::wait(int timeoutMs, std::vector<WatchEvent> &events) {
+  events.clear();
+
+#ifdef __linux__
+  if (isOpened()) {
+    pollfd fds[2] = {{mInotifyFd, POLLIN, 0}, {mWakeFds[0], POLLIN, 0}};
+    if (poll(fds, 2, timeoutMs) <= 0) {
+      return;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char buf[64];
+      while (read(mWakeFds[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      readEvents(events);
+    }
+    return;
+  }
+#endif
+
+  std::unique_lock<std::mutex> lock(mWakeMutex);
+  if (timeoutMs < 0) {
+    mWakeCondition.wait(lock, [this]() { return mWakeUpFlag; });
+  } else {
+    mWakeCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                            [this]() { return mWakeUpFlag; });
+  }
+  mWakeUpFlag = false;
+}
+
+void RecordDirWatcher::wakeUp() {
+#ifdef __linux__
+  if (isOpened()) {
+    const char c = 0;
+    (void)!write(mWakeFds[1], &c, 1);
+    return;
+  }
+#endif
+
+  {
+    std::lock_guard<std::mutex> lock(mWakeMutex);
+    mWakeUpFlag = true;
+  }
+  mWakeCondition.notify_all();
+}
+
+void RecordDirWatcher::close() {
+#ifdef __linux__
+  if (mInotifyFd >= 0) {
+    ::close(mInotifyFd);
+    mInotifyFd = -1;
+  }
+  for (int &fd : mWakeFds) {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+#endif
+  mWatchDirs.clear();
+}
+
+void RecordDirWatcher::addWatch(const std::string &dir,
+                                std::vector<WatchEvent> &events) {
+#ifdef __linux__
+  const int wd = inotify_add_watch(mInotifyFd, dir.c_str(), WATCH_MASK);
+  if (wd < 0) {
+    LOG(WARNING) << "inotify watch failed: " << dir;
+    return;
+  }
+  mWatchDirs[wd] = dir;
+
+  // subscribe to the subdirectories and report the files that may have been
+  // written before the watch was in place
+  std::error_code ec;
+  for (const auto &i : fs::directory_iterator(dir, ec)) {
+    const std::string path = i.path().string();
+    if (fs::is_directory(i.path(), ec)) {
+      addWatch(path, events);
+    } else {
+      events.push_back({WatchEventType::CHANGED, path});
+    }
+  }
+#else
+  (void)dir;
+  (void)events;
+#endif
+}
+
+void RecordDirWatcher::readEvents(std::vector<WatchEvent> &events) {
+#ifdef __linux__
+  alignas(inotify_event) char buf[16384];
+
+  while (true) {
+    const ssize_t len = read(mInotifyFd, buf, sizeof(buf));
+    if (len <= 0) {
+      break;
+    }
+
+    for (ssize_t off = 0; off < len;) {
+      const auto *e = reinterpret_cast<const inotify_event *>(buf + off);
+      off += sizeof(inotify_event) + e->len;
+
+      if (e->mask & IN_Q_OVERFLOW) {
+        events.push_back({WatchEventType::OVERFLOW, ""});
+        continue;
+      }
+
+      const auto it = mWatchDirs.find(e->wd);
+      if (it == mWatchDirs.end()) {
+        continue;
+      }
+
+      if (e->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+        mWatchDirs.erase(it);
+        continue;
+      }
+
+      if (!e->len) {
+        continue;
+      }
+
+      const std::string path = it->second + "/" + e->name;
+      if (e->mask & IN_ISDIR) {
+        if (e->mask & (IN_CREATE | IN_MOVED_TO)) {
+          addWatch(path, events);
+        } else if (e->mask & IN_MOVED_FROM) {
+          // the files went away with it, let the caller rescan
+          events.push_back({WatchEventType::OVERFLOW, ""});
+        }
+        continue;
+      }
+
+      if (e->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        events.push_back({WatchEventType::REMOVED, path});
+      } else {
+        events.push_back({WatchEventType::CHANGED, path});
+      }
+    }
+  }
+#else
+  (void)events;
+#endif
+}
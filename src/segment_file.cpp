@@ -0,0 +1,236 @@
+#include "segment_file.h"
+#include <cstring>
+#include <fcntl.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef WIN32
+ssize_t pwrite(int fd, const void *data, size_t size, uint64_t offset) {
+  if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+    return -1;
+  }
+  return _write(fd, data, static_cast<unsigned int>(size));
+}
+
+int fdatasync(int fd) { return _commit(fd); }
+#endif
+} // namespace
+
+SegmentFile::Sink::~Sink() {
+  if (fd >= 0) {
+#ifdef WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+  }
+}
+
+SegmentFile::SegmentFile() {}
+
+SegmentFile::~SegmentFile() { close(); }
+
+bool SegmentFile::open(const ChunkWriterParams &params) {
+  close();
+
+  auto sink = std::make_shared<Sink>();
+#ifdef WIN32
+  sink->fd = _open(params.path.c_str(),
+                   _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+  sink->fd =
+      ::open(params.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+             0644);
+#endif
+  if (sink->fd < 0) {
+    return false;
+  }
+  sink->syncIntervalSec = params.syncIntervalSec;
+  sink->lastSyncNs = steadyTimeNs();
+
+#ifdef __linux__
+  // reserve the expected extent without changing the visible size, so the
+  // chunk is laid out contiguously
+  if (params.preallocateBytes) {
+    sink->preallocated = fallocate(sink->fd, FALLOC_FL_KEEP_SIZE, 0,
+                                   params.preallocateBytes) == 0;
+    if (!sink->preallocated) {
+      LOG(WARNING) << "chunk preallocation failed: " << params.path;
+    }
+  }
+#endif
+
+  mSink = std::move(sink);
+  mIoWorker = params.ioWorker;
+  mMemoryBudget = mIoWorker ? params.memoryBudget : nullptr;
+  mBufferBytes = std::max<uint32_t>(params.bufferBytes, BLOCK_SIZE);
+  mBufferOffset = 0;
+  mBuffer.clear();
+  mBuffer.reserve(mBufferBytes + BLOCK_SIZE);
+
+  return true;
+}
+
+bool SegmentFile::isOpened() const { return mSink != nullptr; }
+
+bool SegmentFile::good() const { return mSink && !mSink->failed; }
+
+bool SegmentFile::write(const void *data, size_t size) {
+  if (!mSink) {
+    return false;
+  }
+
+  const auto *bytes = static_cast<const uchar *>(data);
+  mBuffer.insert(mBuffer.end(), bytes, bytes + size);
+  if (mBuffer.size() >= mBufferBytes) {
+    flush(false);
+  }
+
+  return !mSink->failed;
+}
+
+bool SegmentFile::patch(uint64_t offset, const void *data, size_t size) {
+  if (!mSink || offset + size > tell()) {
+    return false;
+  }
+
+  const auto *bytes = static_cast<const uchar *>(data);
+
+  // the part still in memory is patched in place
+  if (offset + size > mBufferOffset) {
+    const size_t skip = offset < mBufferOffset ? mBufferOffset - offset : 0;
+    memcpy(&mBuffer[offset + skip - mBufferOffset], bytes + skip,
+           size - skip);
+    size = skip;
+  }
+
+  // the handed off part is rewritten after the pending writes
+  if (size) {
+    auto block = std::make_shared<std::vector<uchar>>(bytes, bytes + size);
+    auto sink = mSink;
+    MemoryBudget *budget = mMemoryBudget;
+    if (budget) {
+      budget->charge(size);
+    }
+    Task task = [sink, block, offset, budget]() {
+      writeAt(*sink, block->data(), block->size(), offset);
+      if (budget) {
+        budget->release(block->size());
+      }
+    };
+    mIoWorker ? mIoWorker->submit(std::move(task)) : task();
+  }
+
+  return !mSink->failed;
+}
+
+uint64_t SegmentFile::tell() const { return mBufferOffset + mBuffer.size(); }
+
+void SegmentFile::sync() {
+  if (!mSink) {
+    return;
+  }
+
+  flush(true);
+
+  auto sink = mSink;
+  Task task = [sink]() {
+    if (!sink->failed && fdatasync(sink->fd) != 0) {
+      sink->failed = true;
+    }
+    sink->lastSyncNs = steadyTimeNs();
+  };
+  mIoWorker ? mIoWorker->submit(std::move(task)) : task();
+}
+
+bool SegmentFile::close() {
+  if (!mSink) {
+    return false;
+  }
+
+  flush(true);
+
+  auto sink = mSink;
+  const uint64_t size = tell();
+  Task task = [sink, size]() {
+#ifndef WIN32
+    // give back the reserved space the chunk did not use
+    if (sink->preallocated && ftruncate(sink->fd, size) != 0) {
+      sink->failed = true;
+    }
+#endif
+    if (!sink->failed && fdatasync(sink->fd) != 0) {
+      sink->failed = true;
+    }
+  };
+  mIoWorker ? mIoWorker->submit(std::move(task)) : task();
+
+  // known here when closed from the io worker itself or without one
+  const bool ok = !mSink->failed;
+  mSink.reset();
+  mBuffer = std::vector<uchar>();
+
+  return ok;
+}
+
+void SegmentFile::flush(bool all) {
+  // whole blocks only unless closing, the tail waits for more data
+  const size_t size =
+      all ? mBuffer.size() : mBuffer.size() / BLOCK_SIZE * BLOCK_SIZE;
+  if (!size) {
+    return;
+  }
+
+  auto block = std::make_shared<std::vector<uchar>>(std::move(mBuffer));
+  mBuffer.assign(block->begin() + size, block->end());
+  mBuffer.reserve(mBufferBytes + BLOCK_SIZE);
+  block->resize(size);
+
+  const uint64_t offset = mBufferOffset;
+  mBufferOffset += size;
+
+  // the queued blocks count against the stream's budget till written
+  auto sink = mSink;
+  MemoryBudget *budget = mMemoryBudget;
+  if (budget) {
+    budget->charge(size);
+  }
+  Task task = [sink, block, offset, budget]() {
+    writeAt(*sink, block->data(), block->size(), offset);
+    if (budget) {
+      budget->release(block->size());
+    }
+
+    // data reaches the disk at a steady pace instead of in one burst when
+    // the page cache decides to
+    if (sink->syncIntervalSec && !sink->failed) {
+      const uint64_t now = steadyTimeNs();
+      if (now - sink->lastSyncNs >= sink->syncIntervalSec * 1000000000ULL) {
+        sink->lastSyncNs = now;
+        if (fdatasync(sink->fd) != 0) {
+          sink->failed = true;
+        }
+      }
+    }
+  };
+  mIoWorker ? mIoWorker->submit(std::move(task)) : task();
+}
+
+void SegmentFile::writeAt(Sink &sink, const uchar *data, size_t size,
+                          uint64_t offset) {
+  while (size && !sink.failed) {
+    const ssize_t n = pwrite(sink.fd, data, size, offset);
+    if (n <= 0) {
+      sink.failed = true;
+      break;
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+}
@@ -0,0 +1,114 @@
+#include "synthetic_source.h"
+#include <thread>
+
+SyntheticSource::SyntheticSource() {}
+
+SyntheticSource::~SyntheticSource() {}
+
+bool SyntheticSource::open(const SyntheticSourceParams &params) {
+  mParams = params;
+  mFrames.clear();
+  mFrameCount = 0;
+  mNextNs = 0;
+
+  if (mParams.frameSize.area() <= 0) {
+    LOG(ERROR) << "bad synthetic frame size";
+    return false;
+  }
+
+  if (mParams.file.empty()) {
+    makePattern();
+    return true;
+  }
+
+  return loadFile();
+}
+
+bool SyntheticSource::isOpened() const { return !mFrames.empty(); }
+
+void SyntheticSource::wait() {
+  if (!mParams.fps) {
+    return;
+  }
+
+  // a reader that fell behind by more than a second starts over instead of
+  // bursting
+  const uint64_t now = steadyTimeNs();
+  if (mNextNs == 0 || now > mNextNs + 1000000000ULL) {
+    mNextNs = now;
+  } else if (now < mNextNs) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(mNextNs - now));
+  }
+  mNextNs += 1000000000ULL / mParams.fps;
+}
+
+bool SyntheticSource::read(cv::Mat &frame) {
+  if (mFrames.empty()) {
+    return false;
+  }
+
+  const cv::Mat &src = mFrames[mFrameCount % mFrames.size()];
+  src.copyTo(frame);
+
+  // a bar sweeping the test pattern, so motion and still detection have
+  // something to see
+  if (mParams.file.empty()) {
+    const int w = std::max(1, frame.cols / 16);
+    const int x = static_cast<int>((mFrameCount * 8) % (frame.cols + w)) - w;
+    cv::rectangle(frame, cv::Rect(x, 0, w, frame.rows),
+                  cv::Scalar(255, 255, 255), cv::FILLED);
+  }
+
+  mFrameCount++;
+  return true;
+}
+
+bool SyntheticSource::loadFile() {
+  cv::VideoCapture capture(mParams.file);
+  if (!capture.isOpened()) {
+    LOG(ERROR) << "synthetic source file could not be opened: "
+               << mParams.file;
+    return false;
+  }
+
+  // decoded once, replaying must not measure the decoder
+  cv::Mat frame;
+  while (mFrames.size() < MAX_REPLAY_FRAMES && capture.read(frame)) {
+    cv::Mat resized;
+    cv::resize(frame, resized, mParams.frameSize, 0, 0, cv::INTER_AREA);
+    mFrames.push_back(resized);
+  }
+
+  if (mFrames.empty()) {
+    LOG(ERROR) << "synthetic source file has no frames: " << mParams.file;
+    return false;
+  }
+
+  return true;
+}
+
+void SyntheticSource::makePattern() {
+  // color bars over a gradient
+  static const cv::Scalar colors[] = {
+      {255, 255, 255}, {0, 255, 255}, {255, 255, 0}, {0, 255, 0},
+      {255, 0, 255},   {0, 0, 255},   {255, 0, 0},   {0, 0, 0}};
+  const int barCount = sizeof(colors) / sizeof(colors[0]);
+
+  cv::Mat pattern(mParams.frameSize, CV_8UC3);
+  const int barsHeight = pattern.rows * 2 / 3;
+  for (int i = 0; i < barCount; ++i) {
+    const int x0 = pattern.cols * i / barCount;
+    const int x1 = pattern.cols * (i + 1) / barCount;
+    cv::rectangle(pattern, cv::Rect(x0, 0, x1 - x0, barsHeight), colors[i],
+                  cv::FILLED);
+  }
+  for (int y = barsHeight; y < pattern.rows; ++y) {
+    uchar *row = pattern.ptr<uchar>(y);
+    for (int x = 0; x < pattern.cols; ++x) {
+      const uchar v = static_cast<uchar>(x * 255 / std::max(1, pattern.cols));
+      row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = v;
+    }
+  }
+
+  mFrames.push_back(pattern);
+}
@@ -1,166 +1,699 @@
 #include "video_out_stream.h"
+#include "cv_chunk_writer.h"
 #include "file_manager.h"
+#include "file_system.h"
+#include "mjpeg_avi_writer.h"
+#include "mp4_fragment_writer.h"
+#include <algorithm>
 
 VideoOutStream::VideoOutStream() {}
 
-VideoOutStream::~VideoOutStream() { releaseChunk(); }
+VideoOutStream::~VideoOutStream() {
+  releaseChunk();
+  mIoWorker.stop();
+
+  // the pre-opened chunk has never been written
+  if (mNextChunk) {
+    mNextChunk->writer->release();
+    std::remove(mNextChunk->preparedPath.c_str());
+    FileManager::instance().chunkDiscarded(mNextChunk->preparedPath);
+  }
+}
+
+namespace {
+// a frame is not used for slots further than this from its capture time and
+// slots are not held back longer than this waiting for a frame
+constexpr uint64_t STALL_NS = 1000000000ULL;
+
+// share of the memory budget the shed policy starts at
+constexpr double SHED_PRESSURE = 0.5;
+
+int64_t wallOffsetNs() {
+  using namespace std::chrono;
+  const int64_t wallNs =
+      duration_cast<nanoseconds>(system_clock::now().time_since_epoch())
+          .count();
+  return wallNs - static_cast<int64_t>(steadyTimeNs());
+}
+} // namespace
 
 bool VideoOutStream::init(const VideoOutStreamParams &params) {
   mParams = params;
 
-  return beginChunk(mLastWriteTime = std::time(nullptr) - 1);
-}
+  const uint32_t idleFps =
+      std::max(1u, std::min(mParams.idleFps, mParams.fps));
+  if (idleFps != mParams.idleFps) {
+    LOG(WARNING) << "idle fps " << mParams.idleFps << " is out of range, "
+                 << idleFps << " is used: " << mParams.name;
+    mParams.idleFps = idleFps;
+  }
+  const uint32_t adaptiveMinFps =
+      std::max(1u, std::min(mParams.adaptiveMinFps, mParams.fps));
+  if (adaptiveMinFps != mParams.adaptiveMinFps) {
+    LOG(WARNING) << "adaptive min fps " << mParams.adaptiveMinFps
+                 << " is out of range, " << adaptiveMinFps
+                 << " is used: " << mParams.name;
+    mParams.adaptiveMinFps = adaptiveMinFps;
+  }
+  if (mParams.recordMode == RecordMode::MOTION_FPS && !mParams.adaptiveFps) {
+    LOG(WARNING) << "motion_fps without adaptive_fps stores every idle slot "
+                    "in full: "
+                 << mParams.name;
+  }
 
-void VideoOutStream::update(const time_t t) {
+  // a frame is held until the next one arrives, so only a few are in flight
+  if (!mFramePool.init(mParams.outputSize, CV_8UC3, 4, mParams.fps + 8)) {
+    return false;
+  }
 
-  // update once per second
-  if (t == mLastWriteTime || !mVideoWriter) {
-    return;
+  // the label follows the stream name and time settings
+  WatermarkParams wp = mParams.watermarkParams;
+  wp.name = mParams.name;
+  wp.useLocaltime = mParams.useLocaltime;
+  if (mParams.watermark && !mWatermark.init(wp, mParams.outputSize)) {
+    return false;
+  }
+
+  mWallOffsetNs = wallOffsetNs();
+  mResampler.reset(mParams.fps, steadyTimeNs());
+  mMemoryBudget.init(mParams.queueBudgetBytes, mParams.memoryBudget);
+
+  if (!mIoWorker.init()) {
+    return false;
+  }
+
+  // our fragmented muxer carries jpeg only
+  if (mParams.fragmentSec) {
+    std::string fourcc(mParams.fourcc, 4);
+    std::transform(fourcc.begin(), fourcc.end(), fourcc.begin(), ::tolower);
+    mFragmented = fourcc == "mjpg";
+    if (!mFragmented) {
+      LOG(WARNING) << "fragmented output needs mjpg, ignored: " << mParams.name;
+    }
+  }
+
+  // our own muxers write one container each, the file names follow it
+  const std::string extension = mFragmented             ? ".mp4"
+                                : mParams.passthrough ? ".avi"
+                                                      : "";
+  if (!extension.empty() && mParams.fileExtension != extension) {
+    LOG(WARNING) << "file extension " << mParams.fileExtension
+                 << " does not match the container, " << extension
+                 << " is used: " << mParams.name;
+    mParams.fileExtension = extension;
+  }
+
+  // the re-encoding writer encodes and stores a repeat like any frame
+  if (mParams.adaptiveFps && !mParams.passthrough && !mFragmented) {
+    LOG(WARNING) << "adaptive fps saves nothing without passthrough or "
+                    "fragmented output: "
+                 << mParams.name;
+  }
+
+  // the lead-in of the event clips
+  mPreEvent.init(mParams.preEventBytes, mParams.preEventSec * mParams.fps);
+
+  // the first chunk is opened here, the following ones ahead of time
+  mLastWriteTime = mLastChunkAttemptTime = std::time(nullptr);
+  std::unique_ptr<OutChunk> chunk = openChunk(mLastWriteTime);
+  if (!chunk) {
+    return false;
+  }
+
+  // kept ready for the first event
+  if (isEventMode()) {
+    std::lock_guard<std::mutex> lock(mNextChunkMutex);
+    mNextChunk = std::move(chunk);
+    mNextChunkDone = mNextChunkRequested = true;
+    return true;
   }
 
-  // process the queue for every second since last update till t - 1
-  while (mLastWriteTime < t) {
-    processQueueForTime(mLastWriteTime + 1);
+  adoptChunk(std::move(chunk), mLastWriteTime);
+
+  return true;
+}
+
+void VideoOutStream::update(const uint64_t tNs) {
+  mWallOffsetNs = wallOffsetNs();
+
+  // write the slots no frame is expected for anymore
+  if (tNs > STALL_NS) {
+    writeSlotsBefore(tNs - STALL_NS, nullptr);
   }
 }
 
-void VideoOutStream::feed(cv::Mat &&frame, const time_t t) {
+void VideoOutStream::feed(cv::Mat &&frame, const time_t t,
+                          const uint64_t tNs, const bool still) {
   VideoFrame vf;
   vf.time = t;
+  vf.timeNs = tNs;
+  vf.still = still;
   vf.frame = std::move(frame);
 
   // watermark
   if (mParams.watermark) {
+    const uint64_t watermarkStartNs = steadyTimeNs();
     watermarkFrame(vf.frame, vf.time);
+    mWatermarkCounter.add(steadyTimeNs() - watermarkStartNs);
   }
 
-  // enqueue
-  mFrameQueue.emplace(std::move(vf));
+  enqueue(std::move(vf));
+}
+
+void VideoOutStream::feedEncoded(EncodedFrame &&encoded, const time_t t,
+                                 const uint64_t tNs, const bool still) {
+  VideoFrame vf;
+  vf.time = t;
+  vf.timeNs = tNs;
+  vf.still = still;
+  vf.encoded = std::move(encoded);
+
+  enqueue(std::move(vf));
+}
+
+cv::Mat VideoOutStream::acquireFrame() { return mFramePool.acquire(); }
+
+FramePoolStats VideoOutStream::framePoolStats() const {
+  return mFramePool.stats();
+}
+
+OutStreamStats VideoOutStream::stats() const {
+  OutStreamStats s;
+  s.freshSlots = mFreshSlots.load(std::memory_order_relaxed);
+  s.duplicatedSlots = mDuplicatedSlots.load(std::memory_order_relaxed);
+  s.blankSlots = mBlankSlots.load(std::memory_order_relaxed);
+  s.droppedFrames = mDroppedFrames.load(std::memory_order_relaxed);
+  s.repeatedFrames = mRepeatedFrames.load(std::memory_order_relaxed);
+  s.backloggedFrames = mBackloggedFrames.load(std::memory_order_relaxed);
+  s.chunks = mChunks.load(std::memory_order_relaxed);
+  s.ioQueueDepth = mIoWorker.pendingTasks();
+  s.preEventBytes = mPreEventBytes.load(std::memory_order_relaxed);
+  s.queueBytes = mMemoryBudget.stats().usedBytes;
+  s.shedFrames = mShedFrames.load(std::memory_order_relaxed);
+  s.thinnedFrames = mThinnedFrames.load(std::memory_order_relaxed);
+  s.downscaledFrames = mDownscaledFrames.load(std::memory_order_relaxed);
+  s.watermark = mWatermarkCounter.snapshot();
+  s.write = mWriteCounter.snapshot();
+  s.encode = mEncodeCounter.snapshot();
+  s.rotate = mRotateCounter.snapshot();
+  s.finalize = mFinalizeCounter.snapshot();
+  return s;
 }
 
 VideoOutStreamParams &VideoOutStream::params() { return mParams; }
 
-void VideoOutStream::processQueueForTime(const time_t t) {
-  // move frames to the buffer
-  std::list<VideoFrame> buffer;
-  while (!mFrameQueue.empty() && mFrameQueue.front().time <= t) {
-    buffer.emplace_back(std::move(mFrameQueue.front()));
-    mFrameQueue.pop();
+void VideoOutStream::triggerEvent(const time_t t) {
+  const time_t until = t + mParams.postEventSec;
+  time_t current = mRecordUntil;
+  while (current < until &&
+         !mRecordUntil.compare_exchange_weak(current, until)) {
   }
+}
 
-  // push a blank frame if the buffer empty
-  if (buffer.empty()) {
-    VideoFrame vf;
-    vf.time = t;
-    vf.frame = cv::Mat(mParams.outputSize, CV_8UC3, cv::Scalar(0, 0, 0));
+RecordMode VideoOutStream::parseRecordMode(const std::string &mode) {
+  if (mode == "event") {
+    return RecordMode::EVENT;
+  }
+  if (mode == "motion") {
+    return RecordMode::MOTION;
+  }
+  if (mode == "motion_fps") {
+    return RecordMode::MOTION_FPS;
+  }
+  return RecordMode::CONTINUOUS;
+}
 
-    // watermark
-    if (mParams.watermark) {
-      watermarkFrame(vf.frame, vf.time);
-    }
+ShedPolicy VideoOutStream::parseShedPolicy(const std::string &policy) {
+  if (policy == "lower_fps") {
+    return ShedPolicy::LOWER_FPS;
+  }
+  if (policy == "downscale") {
+    return ShedPolicy::DOWNSCALE;
+  }
+  if (!policy.empty() && policy != "drop_frames") {
+    LOG(WARNING) << "unknown shed policy, frames are dropped: " << policy;
+  }
+  return ShedPolicy::DROP_FRAMES;
+}
+
+void VideoOutStream::enqueue(VideoFrame &&vf) {
+  // the slots before this frame can be decided now, so the frames are
+  // streamed out one frame interval behind the capture
+  mNextFrameUsed = false;
+  writeSlotsBefore(vf.timeNs, &vf);
 
-    buffer.emplace_back(std::move(vf));
+  if (!mLastFrame.empty() && !mLastFrameUsed) {
+    mDroppedFrames.fetch_add(1, std::memory_order_relaxed);
   }
+  mLastFrame = std::move(vf);
+  mLastFrameUsed = mNextFrameUsed;
+}
+
+void VideoOutStream::writeSlotsBefore(const uint64_t tNs,
+                                      const VideoFrame *next) {
+  while (mResampler.hasSlotBefore(tNs)) {
+    const uint64_t slotNs = mResampler.slotNs();
+    const time_t slotTime = (slotNs + mWallOffsetNs) / 1000000000LL;
 
-  // extend the buffer when frame count less than fps
-  while (buffer.size() < mParams.fps) {
-    // duplicate the buffer frames for a smooth video (bound to the fps)
-    for (auto it = buffer.begin();
-         it != buffer.end() && buffer.size() < mParams.fps; ++it) {
-      it = buffer.insert(it, *it);
-      ++it; // skip newly inserted
+    // pick the nearest frame in capture time (bound to the fps)
+    const VideoFrame *vf = mLastFrame.empty() ? nullptr : &mLastFrame;
+    if (next && (!vf || !mResampler.preferPrev(vf->timeNs, next->timeNs))) {
+      vf = next;
     }
-  }
 
-  // shrink the buffer when frame count more than fps
-  while (buffer.size() > mParams.fps) {
-    // erase half of the buffer frames for a smooth video (bound to the fps)
-    for (auto it = buffer.begin();
-         it != buffer.end() && buffer.size() > mParams.fps; ++it) {
-      it = buffer.erase(it);
+    // a blank frame if the in-stream has nothing near the slot
+    if (vf && FrameResampler::distanceNs(slotNs, vf->timeNs) <= STALL_NS) {
+      bool &used = vf == next ? mNextFrameUsed : mLastFrameUsed;
+      (used ? mDuplicatedSlots : mFreshSlots)
+          .fetch_add(1, std::memory_order_relaxed);
+      used = true;
+      writeSlot(*vf, slotTime);
+    } else {
+      mBlankSlots.fetch_add(1, std::memory_order_relaxed);
+      writeSlot(blankFrame(slotTime), slotTime);
     }
+
+    mResampler.advance();
   }
 
-  // flush the buffer into the video file
-  while (!buffer.empty()) {
-    mVideoWriter->write(buffer.front().frame);
-    buffer.pop_front();
-    mWrittenFramesCount++;
+  // drop the frame when it is too old to be picked for any further slot
+  if (!next && !mLastFrame.empty() &&
+      mResampler.slotNs() > mLastFrame.timeNs + STALL_NS) {
+    if (!mLastFrameUsed) {
+      mDroppedFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+    mLastFrame = VideoFrame();
   }
+}
 
-  mLastWriteTime = t;
+void VideoOutStream::writeSlot(const VideoFrame &vf, const time_t t) {
+  // between events the slots only go to the pre-event buffer and the next
+  // chunk is kept open for the next event
+  if (!isRecording(t)) {
+    releaseChunk();
+    if (!mNextChunkRequested) {
+      prepareChunk(t);
+    }
+
+    mLastWriteTime = t;
+    bufferSlot(vf, t);
+    return;
+  }
 
   // switch to a new chunk if current chunk complete
   const bool newChunkFlag =
-      mParams.chunkLengthSec > 0 &&
+      mParams.chunkLengthSec > 0 && mChunk.writer &&
       (mParams.uniformChunks
-           ? (t % mParams.chunkLengthSec) == 0
-           : mWrittenFramesCount >= (mParams.chunkLengthSec * mParams.fps));
-  if (newChunkFlag) {
-    beginChunk(t);
+           ? (t != mLastWriteTime && (t % mParams.chunkLengthSec) == 0)
+           : mChunk.writtenFrames + mChunk.skippedSlots >=
+                 mParams.chunkLengthSec * mParams.fps);
+  mRotatePending = mRotatePending || newChunkFlag;
+
+  // retry once a second while the next chunk is not ready yet
+  if ((mRotatePending || !mChunk.writer) && t != mLastChunkAttemptTime) {
+    const uint64_t rotateStartNs = steadyTimeNs();
+    rotateChunk(t);
+    mRotateCounter.add(steadyTimeNs() - rotateStartNs);
+  }
+
+  mLastWriteTime = t;
+
+  // without motion the picture is only refreshed at the idle fps
+  const VideoFrame *out = &vf;
+  if (mParams.recordMode == RecordMode::MOTION_FPS && t >= mRecordUntil) {
+    const uint32_t step = std::max(1u, mParams.fps / mParams.idleFps);
+    if (mIdleSlots++ % step && !mHeldFrame.empty()) {
+      out = &mHeldFrame;
+    } else {
+      mHeldFrame = vf;
+    }
+  } else if (mIdleSlots) {
+    mIdleSlots = 0;
+    mHeldFrame = VideoFrame();
+  }
+
+  if (mChunk.writer) {
+    writeChunkFrame(*out);
+  } else if (isEventMode()) {
+    // nothing is lost while the event chunk is being opened
+    bufferSlot(vf, t);
   }
 }
 
+void VideoOutStream::writeChunkFrame(const VideoFrame &vf) {
+  // the same frame again (the in-stream is slower than the fps, a held or a
+  // blank frame) or a still one is a repeat, a real frame still goes out at
+  // the minimal adaptive fps
+  const bool same = mChunk.writtenFrames && vf.timeNs == mLastWrittenNs &&
+                    vf.time == mLastWrittenTime;
+  const uint32_t maxRepeats = mParams.fps / mParams.adaptiveMinFps - 1;
+  if (mParams.adaptiveFps && (same || vf.still) &&
+      mRepeatedSlots < maxRepeats && mChunk.writer->repeatsAreFree() &&
+      mChunk.writer->writeRepeat()) {
+    mChunk.writtenFrames++;
+    mChunk.repeatedFrames++;
+    mRepeatedSlots++;
+    mRepeatedFrames.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  if (shedChunkFrame()) {
+    skipChunkFrame();
+    return;
+  }
+
+  const uint64_t writeStartNs = steadyTimeNs();
+  if (mChunk.writer->write(vf)) {
+    mWriteCounter.add(steadyTimeNs() - writeStartNs);
+    mChunk.writtenFrames++;
+    mLastWrittenNs = vf.timeNs;
+    mLastWrittenTime = vf.time;
+    mRepeatedSlots = 0;
+    if (mChunk.downscaled) {
+      mDownscaledFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+  } else {
+    // the encoder is behind, the slot is left out rather than adding to its
+    // backlog
+    mChunk.skippedSlots++;
+    mBackloggedFrames.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool VideoOutStream::shedChunkFrame() {
+  // a slow disk would otherwise pile the frames up in the io queue
+  const double pressure = mMemoryBudget.pressure();
+  if (pressure < SHED_PRESSURE) {
+    mThinSlots = 0;
+    return false;
+  }
+
+  if (pressure >= 1) {
+    mShedFrames.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  switch (mParams.shedPolicy) {
+  case ShedPolicy::LOWER_FPS: {
+    // every other frame, then one in four towards the budget
+    const uint32_t step = pressure < (1 + SHED_PRESSURE) / 2 ? 2 : 4;
+    if (mThinSlots++ % step) {
+      mThinnedFrames.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+  case ShedPolicy::DOWNSCALE:
+    // nothing is shed, the next chunk is opened smaller instead
+  default:
+    return false;
+  }
+}
+
+void VideoOutStream::skipChunkFrame() {
+  // the slot keeps its time as a repeat where that is free, a re-encoding
+  // writer would spend a full encode on it, so it is left out there
+  if (mChunk.writer->repeatsAreFree() && mChunk.writer->writeRepeat()) {
+    mChunk.writtenFrames++;
+    mChunk.repeatedFrames++;
+  } else {
+    mChunk.skippedSlots++;
+  }
+}
+
+bool VideoOutStream::isRecording(const time_t t) const {
+  return !isEventMode() || t < mRecordUntil;
+}
+
+bool VideoOutStream::isEventMode() const {
+  return mParams.recordMode == RecordMode::EVENT ||
+         mParams.recordMode == RecordMode::MOTION;
+}
+
+void VideoOutStream::bufferSlot(const VideoFrame &vf, const time_t t) {
+  VideoFrame encoded;
+  encoded.time = t;
+  encoded.timeNs = vf.timeNs;
+  encoded.encoded = vf.encoded;
+
+  // raw frames are kept compressed, the buffer is bounded by bytes. This is
+  // a jpeg encode per idle slot on the frame path, and one more decode for
+  // the re-encoding writer once the event fires
+  if (!encoded.encoded) {
+    std::vector<uchar> jpeg;
+    if (!cv::imencode(".jpg", vf.frame, jpeg,
+                      {cv::IMWRITE_JPEG_QUALITY,
+                       MjpegAviWriter::JPEG_QUALITY})) {
+      return;
+    }
+    encoded.encoded =
+        std::make_shared<const std::vector<uchar>>(std::move(jpeg));
+  }
+
+  mPreEvent.push(std::move(encoded));
+  mPreEventBytes.store(mPreEvent.bytes(), std::memory_order_relaxed);
+}
+
+const VideoFrame &VideoOutStream::blankFrame(const time_t t) {
+  // rendered once per second
+  if (mBlankFrame.frame.empty() || mBlankFrame.time != t) {
+    // a new buffer, the writer may still hold on to the previous one
+    mBlankFrame.frame = cv::Mat(mParams.outputSize, CV_8UC3);
+    mBlankFrame.time = t;
+    mBlankFrame.frame.setTo(cv::Scalar(0, 0, 0));
+
+    // watermark
+    if (mParams.watermark) {
+      watermarkFrame(mBlankFrame.frame, mBlankFrame.time);
+    }
+
+    // encoded once as well when passing through or buffering events
+    if (mParams.passthrough || isEventMode()) {
+      std::vector<uchar> jpeg;
+      cv::imencode(".jpg", mBlankFrame.frame, jpeg,
+                   {cv::IMWRITE_JPEG_QUALITY, MjpegAviWriter::JPEG_QUALITY});
+      mBlankFrame.encoded =
+          std::make_shared<const std::vector<uchar>>(std::move(jpeg));
+    }
+  }
+
+  return mBlankFrame;
+}
+
 void VideoOutStream::watermarkFrame(cv::Mat &frame, const time_t t) {
-  std::string label = timeString(t, mParams.useLocaltime) + " " + mParams.name;
+  mWatermark.apply(frame, t);
+}
+
+bool VideoOutStream::rotateChunk(const time_t t) {
+  mLastChunkAttemptTime = t;
 
-  // grey wide label as border
-  cv::putText(frame, label, cv::Point(10, 30), cv::FONT_HERSHEY_PLAIN, 1.5f,
-              cv::Scalar(128, 128, 128, 128), 3, false);
+  // the current chunk goes on meanwhile, it is renamed to its real length
+  if (!mNextChunkRequested) {
+    prepareChunk(t);
+    return false;
+  }
+
+  std::unique_ptr<OutChunk> chunk = takeNextChunk();
+  if (!chunk) {
+    return false;
+  }
 
-  // white narrow label as body
-  cv::putText(frame, label, cv::Point(10, 30), cv::FONT_HERSHEY_PLAIN, 1.5f,
-              cv::Scalar(255, 255, 255, 128), 1, false);
+  adoptChunk(std::move(chunk), t);
+  return true;
 }
 
-bool VideoOutStream::beginChunk(const time_t t) {
+void VideoOutStream::adoptChunk(std::unique_ptr<OutChunk> &&chunk,
+                                const time_t t) {
   // release current video (if exists)
   releaseChunk();
 
-  // set a new writer
-  mVideoWriter.reset(new cv::VideoWriter());
-  mWrittenFramesCount = 0;
+  mChunk = std::move(*chunk);
+  mChunk.startTime = t;
+  mRotatePending = false;
+
+  // the file gets its real name once it is recorded to, a crash before
+  // leaves a prepared file the file manager cleans up. both names stay
+  // tracked till the rename is done, so a rescan in between takes neither
+  // for a leftover
+  FileManager &fm = FileManager::instance();
+  fm.chunkPrepared(mChunk.path);
+  if (rename(mChunk.preparedPath.c_str(), mChunk.path.c_str()) == 0) {
+    fm.chunkOpened(mChunk.path, mChunk.preparedPath);
+  } else {
+    LOG(WARNING) << "chunk could not be renamed, done when finished: "
+                 << mChunk.preparedPath;
+    fm.chunkDiscarded(mChunk.path);
+    fm.chunkOpened(mChunk.preparedPath);
+    mChunk.path = mChunk.preparedPath;
+  }
+  mRepeatedSlots = 0;
+  mChunks.fetch_add(1, std::memory_order_relaxed);
+
+  // an event clip starts with its lead-in
+  VideoFrame vf;
+  uint32_t leadInFrames = 0;
+  while (mPreEvent.pop(vf)) {
+    if (!leadInFrames++) {
+      mChunk.startTime = vf.time;
+    }
+    writeChunkFrame(vf);
+  }
+  mPreEventBytes.store(0, std::memory_order_relaxed);
+
+  // every buffered slot has to be in the clip, its length depends on it
+  if (mChunk.writtenFrames < leadInFrames) {
+    LOG(WARNING) << "event lead-in lost "
+                 << leadInFrames - mChunk.writtenFrames << " of "
+                 << leadInFrames << " frames: " << mParams.name;
+  }
+
+  // open the next one while this one is being written
+  if (mParams.chunkLengthSec) {
+    prepareChunk(nextChunkTime(t));
+  }
+}
+
+bool VideoOutStream::releaseChunk() {
+  if (!mChunk.writer) {
+    return false;
+  }
+
+  // finalized and renamed off the frame path
+  auto chunk = std::make_shared<OutChunk>(std::move(mChunk));
+  chunk->lastWriteTime = mLastWriteTime;
+  mChunk = OutChunk();
+
+  mIoWorker.submit([this, chunk]() { finalizeChunk(*chunk); });
+
+  return true;
+}
+
+std::unique_ptr<OutChunk> VideoOutStream::openChunk(const time_t t) {
+  auto chunk = std::make_unique<OutChunk>();
+
+  // set a new writer, jpeg payloads are muxed as they are when passing
+  // through
+  if (mFragmented) {
+    chunk->writer.reset(new Mp4FragmentWriter());
+  } else if (mParams.passthrough) {
+    chunk->writer.reset(new MjpegAviWriter());
+  } else {
+    chunk->writer.reset(new CvChunkWriter());
+  }
 
   // create a new video file
   const uint32_t len =
-      mParams.uniformChunks
+      mParams.uniformChunks && mParams.chunkLengthSec
           ? (mParams.chunkLengthSec - (t % mParams.chunkLengthSec))
           : mParams.chunkLengthSec;
-  mCurrentVideoFile = FileManager::instance().generateRecordFile(
+  chunk->path = FileManager::instance().generateRecordFile(
       mParams.name, mParams.fileExtension, len, t);
+  chunk->namedStartTime = t;
+
+  // created under a temporary name, not a record before it is adopted
+  chunk->preparedPath = chunk->path + PREPARED_SUFFIX;
+  FileManager::instance().chunkPrepared(chunk->preparedPath);
+
+  ChunkWriterParams cwp;
+  cwp.path = chunk->preparedPath;
+  std::copy(mParams.fourcc, mParams.fourcc + 4, cwp.fourcc);
+  cwp.fps = mParams.fps;
+  cwp.frameSize = mParams.outputSize;
+  // a frame size is fixed per file, so the chunks opened under pressure are
+  // encoded smaller, the writer scales the raw frames on the encode worker
+  chunk->downscaled = mParams.shedPolicy == ShedPolicy::DOWNSCALE &&
+                      !mParams.passthrough && !mFragmented &&
+                      mMemoryBudget.pressure() >= SHED_PRESSURE;
+  if (chunk->downscaled) {
+    cwp.frameSize = cv::Size(mParams.outputSize.width / 2,
+                             mParams.outputSize.height / 2);
+  }
+  cwp.ioWorker = &mIoWorker;
+  cwp.encodePool = mParams.workerPool;
+  cwp.memoryBudget = &mMemoryBudget;
+  cwp.encodeCounter = &mEncodeCounter;
+  cwp.bufferBytes = mParams.writeBufferBytes;
+  cwp.syncIntervalSec = mParams.syncIntervalSec;
+  cwp.fragmentSec = mParams.fragmentSec;
+
+  // reserve what a chunk of this length took last time
+  if (mParams.preallocate) {
+    cwp.preallocateBytes = mAvgFrameBytes * mParams.fps * len;
+  }
 
-  const auto fourccStr = mParams.fourcc;
-  const int fourcc = cv::VideoWriter::fourcc(fourccStr[0], fourccStr[1],
-                                             fourccStr[2], fourccStr[3]);
-  if (!mVideoWriter->open(mCurrentVideoFile, fourcc, mParams.fps,
-                          mParams.outputSize, true)) {
-    LOG(ERROR) << "video file creation failed: " << mCurrentVideoFile;
-    mVideoWriter.reset(nullptr);
-    return false;
+  if (!chunk->writer->open(cwp)) {
+    LOG(ERROR) << "video file creation failed: " << chunk->preparedPath;
+    FileManager::instance().chunkDiscarded(chunk->preparedPath);
+    return nullptr;
   }
 
-  return true;
+  return chunk;
 }
 
-bool VideoOutStream::releaseChunk() {
-  if (!mVideoWriter) {
-    return false;
-  }
+void VideoOutStream::finalizeChunk(OutChunk &chunk) {
+  const uint64_t finalizeStartNs = steadyTimeNs();
+  chunk.writer->release();
+  chunk.writer.reset(nullptr);
 
-  mVideoWriter->release();
-  mVideoWriter.reset(nullptr);
+  std::error_code ec;
+  const uint64_t size = fs::file_size(chunk.path, ec);
+  const uint32_t storedFrames = chunk.writtenFrames - chunk.repeatedFrames;
+  if (!ec && storedFrames) {
+    mAvgFrameBytes = size / storedFrames;
+  }
 
-  // rename the file if incomplete or length is infinite
-  const uint32_t lengthSec = mWrittenFramesCount / mParams.fps;
-  if (mParams.chunkLengthSec && mParams.chunkLengthSec > lengthSec) {
+  // rename the file if incomplete, length is infinite or it was started
+  // later than planned
+  std::string finalFile = chunk.path;
+  const uint32_t lengthSec = chunk.writtenFrames / mParams.fps;
+  if ((mParams.chunkLengthSec && mParams.chunkLengthSec > lengthSec) ||
+      chunk.startTime != chunk.namedStartTime ||
+      chunk.path == chunk.preparedPath) {
 
-    const time_t tStart = mLastWriteTime - lengthSec;
+    // the slots left out still took their time
+    const time_t tStart =
+        chunk.lastWriteTime -
+        (chunk.writtenFrames + chunk.skippedSlots) / mParams.fps;
 
     const std::string &newFileName = FileManager::instance().generateRecordFile(
         mParams.name, mParams.fileExtension, lengthSec, tStart);
 
-    rename(mCurrentVideoFile.c_str(), newFileName.c_str());
+    if (rename(chunk.path.c_str(), newFileName.c_str()) == 0) {
+      finalFile = newFileName;
+    }
   }
 
-  return true;
-}
\ No newline at end of file
+  FileManager::instance().chunkClosed(chunk.path, finalFile,
+                                      chunk.writtenFrames);
+  mFinalizeCounter.add(steadyTimeNs() - finalizeStartNs);
+}
+
+void VideoOutStream::prepareChunk(const time_t t) {
+  mNextChunkRequested = true;
+
+  mIoWorker.submit([this, t]() {
+    std::unique_ptr<OutChunk> chunk = openChunk(t);
+
+    std::lock_guard<std::mutex> lock(mNextChunkMutex);
+    mNextChunk = std::move(chunk);
+    mNextChunkDone = true;
+  });
+}
+
+std::unique_ptr<OutChunk> VideoOutStream::takeNextChunk() {
+  std::lock_guard<std::mutex> lock(mNextChunkMutex);
+  if (!mNextChunkDone) {
+    return nullptr;
+  }
+
+  // a failed open is requested again on the next attempt
+  mNextChunkDone = false;
+  mNextChunkRequested = false;
+  return std::move(mNextChunk);
+}
+
+time_t VideoOutStream::nextChunkTime(const time_t t) const {
+  return mParams.uniformChunks
+             ? t - (t % mParams.chunkLengthSec) + mParams.chunkLengthSec
+             : t + mParams.chunkLengthSec;
+}
@@ -0,0 +1,145 @@
+#include "watermark.h"
+
+namespace {
+constexpr int FONT_FACE = cv::FONT_HERSHEY_PLAIN;
+constexpr int BORDER_THICKNESS = 3;
+constexpr int BODY_THICKNESS = 1;
+constexpr int MARGIN = 10;
+} // namespace
+
+Watermark::Watermark() {}
+
+Watermark::~Watermark() {}
+
+bool Watermark::init(const WatermarkParams &params,
+                     const cv::Size &frameSize) {
+  if (params.scale <= 0 || frameSize.width <= 0 || frameSize.height <= 0) {
+    return false;
+  }
+
+  mParams = params;
+  mFrameSize = frameSize;
+  mRenderedTime = -1;
+
+  return true;
+}
+
+void Watermark::apply(cv::Mat &frame, const time_t t) {
+  // the label only changes once per second
+  if (t != mRenderedTime) {
+    render(t);
+  }
+
+  if (mRoi.empty() || frame.size() != mFrameSize || frame.type() != CV_8UC3) {
+    return;
+  }
+
+  // dst = dst * (255 - a) / 255 + label, both saturating and vectorized by
+  // opencv whatever this build is optimized for
+  cv::Mat roi = frame(mRoi);
+  cv::multiply(roi, mInvAlpha, roi, 1.0 / 255);
+  cv::add(roi, mLabel, roi);
+}
+
+WatermarkPosition Watermark::parsePosition(const std::string &position) {
+  if (position == "top_right") {
+    return WatermarkPosition::TOP_RIGHT;
+  } else if (position == "bottom_left") {
+    return WatermarkPosition::BOTTOM_LEFT;
+  } else if (position == "bottom_right") {
+    return WatermarkPosition::BOTTOM_RIGHT;
+  }
+
+  return WatermarkPosition::TOP_LEFT;
+}
+
+void Watermark::render(const time_t t) {
+  mRenderedTime = t;
+
+  const std::string text = formatLabel(t);
+
+  // the patch covers the text plus the border stroke
+  int baseline = 0;
+  const cv::Size textSize = cv::getTextSize(text, FONT_FACE, mParams.scale,
+                                            BORDER_THICKNESS, &baseline);
+  const cv::Size patchSize(textSize.width + BORDER_THICKNESS * 2,
+                           textSize.height + baseline + BORDER_THICKNESS * 2);
+  const cv::Point textOrigin(BORDER_THICKNESS,
+                             BORDER_THICKNESS + textSize.height);
+
+  cv::Point patchOrigin(MARGIN, MARGIN);
+  if (mParams.position == WatermarkPosition::TOP_RIGHT ||
+      mParams.position == WatermarkPosition::BOTTOM_RIGHT) {
+    patchOrigin.x = mFrameSize.width - MARGIN - patchSize.width;
+  }
+  if (mParams.position == WatermarkPosition::BOTTOM_LEFT ||
+      mParams.position == WatermarkPosition::BOTTOM_RIGHT) {
+    patchOrigin.y = mFrameSize.height - MARGIN - patchSize.height;
+  }
+
+  // clip to the frame, the label is cut rather than dropped
+  const cv::Rect patchRect(patchOrigin, patchSize);
+  mRoi = patchRect & cv::Rect(0, 0, mFrameSize.width, mFrameSize.height);
+  if (mRoi.empty()) {
+    return;
+  }
+
+  // grey wide label as border, white narrow label as body. drawn on black,
+  // so the anti-aliased colors come out premultiplied by the alpha
+  cv::Mat patch(patchSize, CV_8UC3, cv::Scalar(0, 0, 0));
+  cv::Mat alpha(patchSize, CV_8UC1, cv::Scalar(0));
+  cv::putText(patch, text, textOrigin, FONT_FACE, mParams.scale,
+              cv::Scalar(128, 128, 128), BORDER_THICKNESS, cv::LINE_AA);
+  cv::putText(patch, text, textOrigin, FONT_FACE, mParams.scale,
+              cv::Scalar(255, 255, 255), BODY_THICKNESS, cv::LINE_AA);
+  cv::putText(alpha, text, textOrigin, FONT_FACE, mParams.scale,
+              cv::Scalar(255), BORDER_THICKNESS, cv::LINE_AA);
+
+  // keep the visible part of the patch only
+  const cv::Rect visible(mRoi.x - patchRect.x, mRoi.y - patchRect.y,
+                         mRoi.width, mRoi.height);
+  patch(visible).copyTo(mLabel);
+
+  // 3 channel inverse alpha, so blending is two per-element operations
+  mInvAlpha.create(mRoi.size(), CV_8UC3);
+  for (int y = 0; y < mRoi.height; ++y) {
+    const uint8_t *a = alpha.ptr(visible.y + y) + visible.x;
+    uint8_t *inv = mInvAlpha.ptr(y);
+    for (int x = 0; x < mRoi.width; ++x) {
+      inv[x * 3] = inv[x * 3 + 1] = inv[x * 3 + 2] = 255 - a[x];
+    }
+  }
+}
+
+std::string Watermark::formatLabel(const time_t t) const {
+  // strftime part
+  char tmp[256];
+  std::tm tms;
+#ifdef WIN32
+  if (mParams.useLocaltime) {
+    localtime_s(&tms, &t);
+  } else {
+    gmtime_s(&tms, &t);
+  }
+#else
+  if (mParams.useLocaltime) {
+    localtime_r(&t, &tms);
+  } else {
+    gmtime_r(&t, &tms);
+  }
+#endif
+  std::string label =
+      std::strftime(&tmp[0], sizeof(tmp), mParams.textTemplate.c_str(), &tms)
+          ? std::string(tmp)
+          : mParams.textTemplate;
+
+  // placeholders
+  const std::string namePlaceholder = "{name}";
+  size_t pos = 0;
+  while ((pos = label.find(namePlaceholder, pos)) != std::string::npos) {
+    label.replace(pos, namePlaceholder.length(), mParams.name);
+    pos += mParams.name.length();
+  }
+
+  return label;
+}
@@ -0,0 +1,127 @@
+#include "worker_pool.h"
+#include "globals.h"
+
+namespace {
+thread_local WorkerPool *tlPool = nullptr;
+thread_local uint32_t tlWorkerIndex = 0;
+} // namespace
+
+WorkerPool::WorkerPool() {}
+
+WorkerPool::~WorkerPool() { stop(); }
+
+bool WorkerPool::init(uint32_t threadCount) {
+  if (!mWorkers.empty()) {
+    return false;
+  }
+
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  mExitFlag = false;
+  for (uint32_t i = 0; i < threadCount; ++i) {
+    mWorkers.emplace_back(new Worker());
+  }
+
+  for (uint32_t i = 0; i < threadCount; ++i) {
+    mWorkers[i]->thread = std::thread([this, i]() { workerLoop(i); });
+  }
+
+  LOG(INFO) << "worker pool started with " << threadCount << " threads.";
+
+  return true;
+}
+
+void WorkerPool::submit(Task &&task) {
+  if (mWorkers.empty()) {
+    task();
+    return;
+  }
+
+  // keep the task local when submitted from a worker, spread otherwise
+  const uint32_t index =
+      tlPool == this ? tlWorkerIndex
+                     : mNextWorker.fetch_add(1, std::memory_order_relaxed) %
+                           mWorkers.size();
+  {
+    std::lock_guard<std::mutex> lock(mWorkers[index]->mutex);
+    mWorkers[index]->tasks.emplace_back(std::move(task));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mWakeMutex);
+    mPendingTasks++;
+  }
+  mWakeCondition.notify_one();
+}
+
+void WorkerPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mWakeMutex);
+    mExitFlag = true;
+  }
+  mWakeCondition.notify_all();
+
+  for (auto &w : mWorkers) {
+    if (w->thread.joinable()) {
+      w->thread.join();
+    }
+  }
+  mWorkers.clear();
+}
+
+uint32_t WorkerPool::threadCount() const { return mWorkers.size(); }
+
+void WorkerPool::workerLoop(uint32_t index) {
+  tlPool = this;
+  tlWorkerIndex = index;
+
+  Task task;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mWakeMutex);
+      mWakeCondition.wait(lock,
+                          [this]() { return mPendingTasks > 0 || mExitFlag; });
+      if (mExitFlag) {
+        break;
+      }
+    }
+
+    if (popTask(index, task) || stealTask(index, task)) {
+      mPendingTasks--;
+      task();
+      task = nullptr;
+    } else {
+      // another worker has just taken it
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool WorkerPool::popTask(uint32_t index, Task &task) {
+  Worker &w = *mWorkers[index];
+  std::lock_guard<std::mutex> lock(w.mutex);
+  if (w.tasks.empty()) {
+    return false;
+  }
+
+  task = std::move(w.tasks.back());
+  w.tasks.pop_back();
+  return true;
+}
+
+bool WorkerPool::stealTask(uint32_t index, Task &task) {
+  const uint32_t count = mWorkers.size();
+  for (uint32_t i = 1; i < count; ++i) {
+    Worker &w = *mWorkers[(index + i) % count];
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.tasks.empty()) {
+      task = std::move(w.tasks.front());
+      w.tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,255 @@
+// Runs the mjpeg http loop against a multipart server on the loopback: parts
+// with and without content-length, a stalled stream, a refused port and a
+// host name. Exits non-zero on the first failed check.
+
+#include "mjpeg_http_loop.h"
+#include <arpa/inet.h>
+#include <functional>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+const std::string BOUNDARY = "frame";
+
+class TestSink : public IMjpegSink {
+public:
+  std::vector<uchar> *acquireJpeg() override { return &mBuffer; }
+
+  void commitJpeg(uint64_t) override {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPayloads.push_back(mBuffer);
+    mCondition.notify_all();
+  }
+
+  void tick() override {}
+
+  void streamChanged(bool healthy) override {
+    std::lock_guard<std::mutex> lock(mMutex);
+    (healthy ? mUps : mDowns)++;
+    mCondition.notify_all();
+  }
+
+  bool waitFor(const std::function<bool()> &done, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                               done);
+  }
+
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::vector<uchar> mBuffer;
+  std::vector<std::vector<uchar>> mPayloads;
+  int mUps = 0;
+  int mDowns = 0;
+};
+
+// accepts on an ephemeral loopback port, each connection gets the handler
+// once its request is read
+class TestServer {
+public:
+  using Handler = std::function<void(int fd)>;
+
+  bool start(Handler handler) {
+    mHandler = std::move(handler);
+    mFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (mFd < 0 || bind(mFd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(mFd, 8) != 0 || getsockname(mFd, (sockaddr *)&addr, &len)) {
+      return false;
+    }
+    mPort = ntohs(addr.sin_port);
+    mThread = std::thread([this]() { acceptLoop(); });
+    return true;
+  }
+
+  void stop() {
+    shutdown(mFd, SHUT_RDWR);
+    if (mThread.joinable()) {
+      mThread.join();
+    }
+    for (auto &t : mConnections) {
+      t.join();
+    }
+    ::close(mFd);
+  }
+
+  std::string uri() const {
+    return "http://127.0.0.1:" + std::to_string(mPort) + "/stream";
+  }
+
+  std::atomic<int> mAccepts = 0;
+
+private:
+  void acceptLoop() {
+    int fd;
+    while ((fd = accept(mFd, nullptr, nullptr)) >= 0) {
+      mAccepts++;
+      mConnections.emplace_back([this, fd]() {
+        std::string request;
+        char c;
+        while (request.find("\r\n\r\n") == std::string::npos &&
+               recv(fd, &c, 1, 0) == 1) {
+          request += c;
+        }
+        mHandler(fd);
+
+        // till the loop lets go
+        while (recv(fd, &c, 1, 0) > 0) {
+        }
+        ::close(fd);
+      });
+    }
+  }
+
+  Handler mHandler;
+  int mFd = -1;
+  uint16_t mPort = 0;
+  std::thread mThread;
+  std::vector<std::thread> mConnections;
+};
+
+void sendAll(int fd, const std::string &data) {
+  for (size_t sent = 0; sent < data.size();) {
+    const ssize_t n =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;
+    }
+    sent += n;
+  }
+}
+
+std::string responseHeaders() {
+  return "HTTP/1.0 200 OK\r\nContent-Type: multipart/x-mixed-replace; "
+         "boundary=" +
+         BOUNDARY + "\r\n\r\n";
+}
+
+std::string part(const std::string &payload, bool withLength) {
+  std::string p = "--" + BOUNDARY + "\r\nContent-Type: image/jpeg\r\n";
+  if (withLength) {
+    p += "Content-Length: " + std::to_string(payload.size()) + "\r\n";
+  }
+  return p + "\r\n" + payload + "\r\n";
+}
+
+// a large one is received in place, binary data checks the framing, the
+// bare boundary inside one the delimiter matching
+std::vector<std::string> testPayloads(bool withCrLf) {
+  std::vector<std::string> payloads;
+  for (size_t i = 0; i < 5; ++i) {
+    std::string p(i == 2 ? 300000 : 1000 + i, '\0');
+    for (size_t j = 0; j < p.size(); ++j) {
+      p[j] = static_cast<char>(j * 7 + i);
+    }
+    if (!withCrLf) {
+      // only the delimiter with its dashes ends a part
+      std::replace(p.begin(), p.end(), '-', '+');
+      p.replace(20, BOUNDARY.size(), BOUNDARY);
+    } else {
+      p.replace(10, 4, "\r\n--");
+    }
+    payloads.push_back(p);
+  }
+  return payloads;
+}
+
+MjpegHttpSourceParams sourceParams(const std::string &uri) {
+  MjpegHttpSourceParams sp;
+  sp.name = "TEST";
+  sp.uri = uri;
+  sp.connectTimeoutMs = 1000;
+  sp.stallTimeoutSec = 1;
+  sp.reconnectMinMs = 100;
+  sp.reconnectMaxMs = 200;
+  return sp;
+}
+
+void testParts(MjpegHttpLoop &loop, bool withLength) {
+  const std::vector<std::string> payloads = testPayloads(withLength);
+  TestServer server;
+  CHECK(server.start([&](int fd) {
+    std::string data = responseHeaders();
+    for (const auto &p : payloads) {
+      data += part(p, withLength);
+    }
+    // the last part without a length ends at the next boundary
+    sendAll(fd, data + "--" + BOUNDARY + "\r\n");
+  }));
+
+  TestSink sink;
+  CHECK(loop.add(&sink, sourceParams(server.uri())));
+  CHECK(sink.waitFor([&]() { return sink.mPayloads.size() >= 5; }, 5000))
+      << "payloads received: " << sink.mPayloads.size();
+  loop.remove(&sink);
+  server.stop();
+
+  for (size_t i = 0; i < payloads.size(); ++i) {
+    CHECK(std::string(sink.mPayloads[i].begin(), sink.mPayloads[i].end()) ==
+          payloads[i])
+        << "payload " << i << " differs, content-length " << withLength;
+  }
+  CHECK(sink.mUps == 1);
+}
+
+void testStall(MjpegHttpLoop &loop) {
+  TestServer server;
+  CHECK(server.start([](int fd) {
+    sendAll(fd, responseHeaders() + part("first", true));
+  }));
+
+  TestSink sink;
+  CHECK(loop.add(&sink, sourceParams(server.uri())));
+  CHECK(sink.waitFor([&]() { return sink.mDowns >= 1; }, 5000))
+      << "stall not detected";
+  CHECK(sink.waitFor([&]() { return server.mAccepts >= 2; }, 5000))
+      << "no reconnect after the stall";
+  loop.remove(&sink);
+  server.stop();
+}
+
+void testRefused(MjpegHttpLoop &loop) {
+  // a bound port without a listener refuses
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  CHECK(bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+        getsockname(fd, (sockaddr *)&addr, &len) == 0);
+
+  TestSink sink;
+  CHECK(loop.add(&sink, sourceParams("http://127.0.0.1:" +
+                                     std::to_string(ntohs(addr.sin_port)) +
+                                     "/stream")));
+  CHECK(!sink.waitFor([&]() { return sink.mUps > 0; }, 1000));
+  loop.remove(&sink);
+  ::close(fd);
+  CHECK(sink.mPayloads.empty());
+}
+
+void testHostName(MjpegHttpLoop &loop) {
+  TestSink sink;
+  CHECK(!loop.add(&sink, sourceParams("http://camera.invalid:81/stream")));
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  google::InitGoogleLogging(argv[0]);
+
+  MjpegHttpLoop loop;
+  testParts(loop, true);
+  testParts(loop, false);
+  testStall(loop);
+  testRefused(loop);
+  testHostName(loop);
+  loop.stop();
+
+  LOG(INFO) << "mjpeg http loop test passed";
+  return 0;
+}